@@ -1,9 +1,17 @@
 #include <ctype.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <termios.h>
 #include <unistd.h>
 
@@ -27,8 +35,10 @@ void enableRawMode(struct termios* orig_termios) {
   raw.c_cflag |= (CS8);
   /* TODO: will ISIG affect signal when dynamically adjust windows size? */
   raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+  /* Reads never block: keys are waited for with poll, see editorWait, and
+   * how long an ESC waits for the rest of a sequence is ESC_TIMEOUT. */
   raw.c_cc[VMIN] = 0;
-  raw.c_cc[VTIME] = 1;
+  raw.c_cc[VTIME] = 0;
 
   check(tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1, "enableRawMode");
 }
@@ -46,16 +56,63 @@ void disableMouseEvent() {
   write(STDOUT_FILENO, "\e[?1000;1006;1015l", 24);
 };
 
+/* pasted text comes between \x1b[200~ and \x1b[201~, see editorPaste */
+void enableBracketedPaste() {
+  write(STDOUT_FILENO, "\x1b[?2004h", 8);
+}
+
+void disableBracketedPaste() {
+  write(STDOUT_FILENO, "\x1b[?2004l", 8);
+}
+
+/* Ask whether the terminal has synchronized output (DEC mode 2026). Those
+ * without DECRQM don't answer, see readInput for the reply. */
+void querySynchronizedOutput() {
+  write(STDOUT_FILENO, "\x1b[?2026$p", 9);
+}
+
+/* Take SIGWINCH as an event of editorWait instead of a signal handler,
+ * which could draw in the middle of a frame. Call it before starting any
+ * thread, so that none of them takes the signal. */
+void enableResizeEvent(editorConfig* E) {
+  sigset_t mask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGWINCH);
+  check(sigprocmask(SIG_BLOCK, &mask, NULL) == -1, "block SIGWINCH");
+  E->resizefd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  check(E->resizefd == -1, "signalfd");
+}
+
 void initEditor(editorConfig* E) {
   E->mode = NORMAL_MODE;
+  E->engine = ENGINE_ROWS;
   E->cx = 0;
   E->cy = 0;
   E->rx = 0;
   E->ry = 0;
   E->tx = 1;
   E->ty = 1;
-  E->data = NULL;
+  E->rows = (rowTree)ROW_TREE_INIT;
+  E->cache = NULL;
+  E->cachecap = 0;
+  E->cachehead = 0;
+  E->cachelen = 0;
+  E->query = NULL;
+  E->frameoff = -1;
+  E->gutter = NULL;
+  E->guttertop = -1;
+  E->gutterrows = 0;
+  E->map = NULL;
+  E->mapsize = 0;
+  E->loading = 0;
+  E->loadoff = 0;
+  E->loadbuf = NULL;
+  E->loadcap = 0;
+  E->pieces = (pieceTable)PIECE_TABLE_INIT;
+  E->hot = NULL;
+  E->undo = (pieceSnapshot)PIECE_SNAPSHOT_INIT;
   E->keyStroke = ' ';
+  E->typedlen = 0;
   E->dirty = 0;
   E->numrows = 0;
   E->searchResultRow = -1;
@@ -66,44 +123,46 @@ void initEditor(editorConfig* E) {
   E->statusmsg[0] = '\0';
   E->statusmsg_time = 0;
   E->keystroke_time = 0;
-  check(getWindowSize(&E->screenrows, &E->screencols) == -1, "getWindowSize");
+  inputInit(&E->input, STDIN_FILENO);
+  E->resizefd = -1;
+  check(getWindowSize(&E->input, &E->screenrows, &E->screencols) == -1,
+        "getWindowSize");
 
   /* for status bar */
   E->screenrows -= 2;
 }
 
 void updateEditor(editorConfig* E) {
-  check(getWindowSize(&E->screenrows, &E->screencols) == -1, "getWindowSize");
+  check(getWindowSize(&E->input, &E->screenrows, &E->screencols) == -1,
+        "getWindowSize");
   E->screenrows -= 2;
+  /* the terminal may have moved or dropped what it showed */
+  screenInvalidate(&E->screen);
 }
 
-int getCursorPosition(int* rows, int* cols) {
-  char buf[32];
-  unsigned int i = 0;
+/* Ask the terminal where the cursor is. Keys typed meanwhile and other
+ * replies stay in the input for readInput. */
+int getCursorPosition(input* in, int* rows, int* cols) {
   if (write(STDOUT_FILENO, "\x1b[6n", 4) != 4)
     return -1;
-  while (i < sizeof(buf) - 1) {
-    if (read(STDIN_FILENO, &buf[i], 1) != 1)
-      break;
-    if (buf[i] == 'R')
-      break;
-    i++;
+  while (!inputTakeReply(in, CURSOR_REPORT)) {
+    /* only new input can hold it, what's buffered was looked at */
+    struct pollfd fd = {in->fd, POLLIN, 0};
+    if (poll(&fd, 1, 1000) <= 0 || inputFill(in) <= 0)
+      return -1;
   }
-  buf[i] = '\0';
-  if (buf[0] != '\x1b' || buf[1] != '[')
-    return -1;
-  if (sscanf(&buf[2], "%d;%d", rows, cols) != 2)
-    return -1;
-  return 0;
+  *rows = in->params[0];
+  *cols = in->params[1];
+  return *rows > 0 && *cols > 0 ? 0 : -1;
 }
 
-int getWindowSize(int* rows, int* cols) {
+int getWindowSize(input* in, int* rows, int* cols) {
   struct winsize ws;
 
   if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
     if (write(STDOUT_FILENO, "\x1b[999C\x1b[999B", 12) != 12)
       return -1;
-    return getCursorPosition(rows, cols);
+    return getCursorPosition(in, rows, cols);
   } else {
     *cols = ws.ws_col;
     *rows = ws.ws_row;
@@ -115,7 +174,20 @@ void editorOpen(editorConfig* E, char* filename) {
   free(E->filename);
   E->filename = strdup(filename);
 
-  FILE* fp = fopen(filename, "r");
+  int fd = open(filename, O_RDONLY);
+  check(fd == -1, "Fail to open %s", filename);
+
+  struct stat st;
+  /* the piece table always uses the mapping as its original buffer */
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+      (st.st_size >= MMAP_OPEN_THRESHOLD || E->engine == ENGINE_PIECES)) {
+    editorOpenMapped(E, fd, st.st_size);
+    close(fd);
+    E->dirty = 0;
+    return;
+  }
+
+  FILE* fp = fdopen(fd, "r");
   check(!fp, "Fail to open %s", filename);
 
   char* line = NULL;
@@ -135,13 +207,154 @@ void editorOpen(editorConfig* E, char* filename) {
   E->dirty = 0;
 }
 
+void editorOpenMapped(editorConfig* E, int fd, size_t size) {
+  /* Rows reference byte ranges of a private read-only mapping, nothing is
+   * copied at load time. A row gets its own heap copy the first time it is
+   * edited (rowDetach), render & hl are built when first displayed or
+   * searched (rowMaterialize). */
+  char* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  check(map == MAP_FAILED, "Fail to mmap %s", E->filename);
+  madvise(map, size, MADV_SEQUENTIAL);
+  E->map = map;
+  E->mapsize = size;
+  E->pieces.orig = map;
+  E->pieces.origsize = size;
+
+  /* Lines are found by a background thread and arrive in chunks, only
+   * wait for the first screen here. */
+  E->loading = 1;
+  E->loadoff = 0;
+  loaderStart(&E->load, map, size);
+  editorLoadWait(E, E->screenrows);
+}
+
+static int editorLoadChunk(editorConfig* E, int wait) {
+  if (!E->loading)
+    return 0;
+
+  int done;
+  int n = loaderTake(&E->load, &E->loadbuf, &E->loadcap, wait, &done);
+  if (n > 0) {
+    /* appending never moves existing rows, E->hot stays valid */
+    for (int i = 0; i < n; i++) {
+      char* p = E->map + E->loadoff;
+      int len = E->loadbuf[i] - E->loadoff;
+      while (len > 0 && (p[len - 1] == '\n' || p[len - 1] == '\r'))
+        len--;
+
+      row row;
+      row.size = len;
+      row.chars = p;
+      row.gap = len;
+      row.gaplen = 0;
+      row.rsize = 0;
+      row.hl = NULL;
+      row.flags = ROW_SHARED;
+      rowTreeInsert(&E->rows, E->numrows++, &row);
+
+      E->loadoff = E->loadbuf[i];
+    }
+  }
+
+  if (done) {
+    loaderStop(&E->load);
+    free(E->loadbuf);
+    E->loadbuf = NULL;
+    E->loadcap = 0;
+    E->loading = 0;
+    madvise(E->map, E->mapsize, MADV_RANDOM);
+    return 1;
+  }
+  return n > 0;
+}
+
+/* Take whatever the loader published so far, returns whether the rows or
+ * the loading state changed. */
+int editorLoadPoll(editorConfig* E) {
+  return editorLoadChunk(E, 0);
+}
+
+/* Block until at least numrows rows exist or the file is fully loaded. */
+void editorLoadWait(editorConfig* E, int numrows) {
+  while (E->loading && E->numrows < numrows)
+    editorLoadChunk(E, 1);
+}
+
+static int writeAll(int fd, struct iovec* iov, int n) {
+  while (n > 0) {
+    ssize_t rc = writev(fd, iov, n);
+    if (rc == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    /* skip what was written, partially written entries are adjusted */
+    while (n > 0 && (size_t)rc >= iov->iov_len) {
+      rc -= iov->iov_len;
+      iov++;
+      n--;
+    }
+    if (n > 0) {
+      iov->iov_base = (char*)iov->iov_base + rc;
+      iov->iov_len -= rc;
+    }
+  }
+  return 0;
+}
+
+/* iovecs queued for writeAll */
+typedef struct rowWriter {
+  int fd;
+  int failed;
+  int n;
+  struct iovec iov[WRITE_IOV_BATCH];
+} rowWriter;
+
+static void writerFlush(rowWriter* w) {
+  if (w->n > 0 && !w->failed && writeAll(w->fd, w->iov, w->n) == -1)
+    w->failed = 1;
+  w->n = 0;
+}
+
+static void writerAdd(const char* text, int len, void* arg) {
+  rowWriter* w = arg;
+  if (len == 0)
+    return;
+  w->iov[w->n++] = (struct iovec){(char*)text, len};
+  if (w->n == WRITE_IOV_BATCH)
+    writerFlush(w);
+}
+
+/* Stream the rows to fd straight from their text, both sides of the gap or
+ * every rope leaf, without building a copy of the whole file. Returns bytes
+ * written or -1. */
+static long editorWriteRows(editorConfig* E, int fd) {
+  rowWriter w;
+  w.fd = fd;
+  w.failed = 0;
+  w.n = 0;
+  rowIter it;
+  for (row* row = rowTreeSeek(&E->rows, 0, &it); row; row = rowTreeNext(&it)) {
+    if (row->flags & ROW_ROPE) {
+      ropeEach(row->rope, writerAdd, &w);
+    } else {
+      char* text = ROW_TEXT(row);
+      writerAdd(text, row->gap, &w);
+      writerAdd(&text[row->gap + row->gaplen], row->size - row->gap, &w);
+    }
+    /* size + 1 is because we strip off \n when read it in the buffer */
+    writerAdd("\n", 1, &w);
+  }
+  writerFlush(&w);
+  return w.failed ? -1 : rowTreeBytes(&E->rows);
+}
+
 void editorSave(editorConfig* E) {
-  /* TODO: more advance saving technique,
-  write to a temp file, then rename it as current file */
   if (E->dirty == 0) {
     setStatusMessage(E, "No write since last change.");
     return;
   }
+  editorLoadWait(E, INT_MAX);
   if (E->filename == NULL) {
     E->filename = promptInfo(E, "Save as: %s (ESC to cancel)");
     if (E->filename == NULL) {
@@ -149,23 +362,25 @@ void editorSave(editorConfig* E) {
       return;
     }
   }
-  int len;
-  char* buf = rowsToString(E, &len);
-
-  int fd = open(E->filename, O_RDWR | O_CREAT, 0644);
+  /* Write to a temp file, then rename it as current file. Rows of a mapped
+   * file still point into the old inode, truncating it in place would pull
+   * the data out from under them. */
+  char* tmpname = malloc(strlen(E->filename) + 8);
+  sprintf(tmpname, "%s.XXXXXX", E->filename);
+  int fd = mkstemp(tmpname);
   if (fd != -1) {
-    if (ftruncate(fd, len) != -1) {
-      if (write(fd, buf, len) == len) {
-        close(fd);
-        free(buf);
-        E->dirty = 0;
-        setStatusMessage(E, "%d bytes written to disk", len);
-        return;
-      }
+    struct stat st;
+    fchmod(fd, stat(E->filename, &st) == 0 ? st.st_mode & 07777 : 0644);
+    long len = editorWriteRows(E, fd);
+    if (close(fd) == 0 && len != -1 && rename(tmpname, E->filename) == 0) {
+      free(tmpname);
+      E->dirty = 0;
+      setStatusMessage(E, "%ld bytes written to disk", len);
+      return;
     }
-    close(fd);
+    unlink(tmpname);
   }
-  free(buf);
+  free(tmpname);
   setStatusMessage(E, "Can't save! I/O error: %s", strerror(errno));
 }
 
@@ -175,17 +390,462 @@ void editorQuit(editorConfig* E) {
                      "Unsave change. :w <filename> -> save; :q! -> force quit");
     return;
   }
+  /* the last frame first, or it would be drawn over the cleared screen */
+  screenSync(&E->screen);
+  disableBracketedPaste();
   write(STDOUT_FILENO, "\x1b[2J", 4);
   write(STDOUT_FILENO, "\x1b[H", 3);
   exit(0);
 }
 
+void editorGotoLine(editorConfig* E, int line) {
+  editorLoadWait(E, line);
+  if (E->numrows == 0)
+    return;
+  if (line < 1)
+    line = 1;
+  if (line > E->numrows)
+    line = E->numrows;
+  E->cy = line - 1;
+  E->cx = 0;
+}
+
+/* Put the cursor on byte offset of the text as saved, 0 based. */
+void editorGotoByte(editorConfig* E, long offset) {
+  /* rows arrive in file order, wait for the one holding offset */
+  while (E->loading && E->loadoff <= (size_t)offset)
+    editorLoadChunk(E, 1);
+  if (E->numrows == 0)
+    return;
+  E->cy = rowTreeRowAt(&E->rows, offset);
+  long start = rowTreeOffset(&E->rows, E->cy);
+  /* like vim, a newline puts the cursor on the last character */
+  int last = editorRow(E, E->cy)->size - 1;
+  E->cx = offset - start < last ? offset - start : last;
+  if (E->cx < 0)
+    E->cx = 0;
+}
+
+int editorPercent(editorConfig* E) {
+  if (E->numrows == 0)
+    return 0;
+  /* bytes through the end of the cursor row, out of the whole file while
+   * it's still being loaded */
+  long total = rowTreeBytes(&E->rows);
+  if (E->loading && E->mapsize > (size_t)total)
+    total = E->mapsize;
+  return rowTreeOffset(&E->rows, E->cy + 1) * 100 / total;
+}
+
+/* ENGINE_PIECES: commit the row being edited, if any. Needed before rows
+ * move around, E->hot would no longer point at it. */
+static void editorCommitHot(editorConfig* E) {
+  if (E->hot) {
+    rowCommit(E, E->hot);
+    E->hot = NULL;
+  }
+}
+
+row* editorRow(editorConfig* E, int at) {
+  return rowTreeGet(&E->rows, at);
+}
+
+static void editorSnapshot(editorConfig* E, pieceSnapshot* snap) {
+  editorCommitHot(E);
+  snap->pieces = realloc(snap->pieces, sizeof(piece) * (E->numrows + 1));
+  check(snap->pieces == NULL, "Fail to allocate snapshot");
+  rowIter it;
+  row* row = rowTreeSeek(&E->rows, 0, &it);
+  for (int j = 0; j < E->numrows; j++, row = rowTreeNext(&it)) {
+    snap->pieces[j].text = row->chars;
+    snap->pieces[j].len = row->size;
+  }
+  snap->n = E->numrows;
+  snap->cx = E->cx;
+  snap->cy = E->cy;
+}
+
+static void editorRestore(editorConfig* E, pieceSnapshot* snap) {
+  rowIter it;
+  for (row* row = rowTreeSeek(&E->rows, 0, &it); row; row = rowTreeNext(&it))
+    freerow(row);
+  rowTreeClear(&E->rows);
+  for (int j = 0; j < snap->n; j++) {
+    row row;
+    row.size = snap->pieces[j].len;
+    row.chars = (char*)snap->pieces[j].text;
+    row.gap = row.size;
+    row.gaplen = 0;
+    row.rsize = 0;
+    row.hl = NULL;
+    row.flags = ROW_SHARED;
+    rowTreeInsert(&E->rows, j, &row);
+  }
+  E->numrows = snap->n;
+  E->cx = snap->cx;
+  E->cy = snap->cy;
+  E->hot = NULL;
+  E->cachelen = 0;
+  E->dirty++;
+}
+
+/* Remember the rows before a change so that it can be undone. With
+ * ENGINE_PIECES every row is a piece of immutable text, so this only copies
+ * the piece descriptors. */
+void editorCheckpoint(editorConfig* E) {
+  if (E->engine != ENGINE_PIECES)
+    return;
+  editorLoadWait(E, INT_MAX);
+  editorSnapshot(E, &E->undo);
+}
+
+void editorUndo(editorConfig* E) {
+  if (E->engine != ENGINE_PIECES) {
+    setStatusMessage(E, "Undo needs the piece table engine (-p)");
+    return;
+  }
+  if (E->undo.pieces == NULL) {
+    setStatusMessage(E, "Already at oldest change");
+    return;
+  }
+  /* the current rows become the new undo point, so u again redoes */
+  pieceSnapshot redo = PIECE_SNAPSHOT_INIT;
+  editorSnapshot(E, &redo);
+  editorRestore(E, &E->undo);
+  pieceSnapshotFree(&E->undo);
+  E->undo = redo;
+}
+
+/* columns between tab stops, for renders and ropes alike */
+int tabWidth = TAB_WIDTH;
+
+/* Columns from column col to the next tab stop, the usual widths as a
+ * mask instead of a division. */
+int tabColumns(int col) {
+  switch (tabWidth) {
+    case 2:
+      return 2 - (col & 1);
+    case 4:
+      return 4 - (col & 3);
+    case 8:
+      return 8 - (col & 7);
+    default:
+      return tabWidth - col % tabWidth;
+  }
+}
+
+/* Render bytes a row's block has room for, before the render and in it:
+ * the render starts there, and only moves once an edit takes it past. */
+static int rowRenderCap(int rsize) {
+  int step = RENDER_SLACK;
+  while (step * 8 < rsize)
+    step *= 2;
+  return (rsize + step - 1) & ~(step - 1);
+}
+
+/* Where a render's char stops start in its block, after the highlight and
+ * the render, see rowStops. */
+static int rowStopsOffset(int rsize) {
+  return (rowRenderCap(rsize) * 2 + 1 + 3) & ~3;
+}
+
+/* Bytes of the block holding a row's highlight and render, and with the
+ * render the count of char stops and the stops. */
+static int rowRenderBytes(int rsize, int alias, int stops) {
+  if (alias)
+    return rsize + 1;
+  return rowStopsOffset(rsize) + sizeof(int) + sizeof(charStop) * stops;
+}
+
+/* Char stops of a rendered row that isn't ROW_ALIAS, *n of them. */
+static charStop* rowStops(row* row, int* n) {
+  int* count = (int*)&row->hl[rowStopsOffset(row->rsize)];
+  *n = *count;
+  return (charStop*)&count[1];
+}
+
+/* Bytes of a rendered row's block as it is. */
+static int rowBlockBytes(row* row) {
+  if (row->flags & ROW_ALIAS)
+    return rowRenderBytes(row->rsize, 1, 0);
+  int stops;
+  rowStops(row, &stops);
+  return rowRenderBytes(row->rsize, 0, stops);
+}
+
+/* The last char stop of a rendered row that starts at or before pos, in
+ * text bytes, render bytes or columns as field is offsetof cx, rb or rx.
+ * NULL if there is none. */
+static charStop* rowStopAt(row* row, size_t field, int pos) {
+  if (row->flags & ROW_ALIAS)
+    return NULL;
+  int n;
+  charStop* stop = rowStops(row, &n);
+  int lo = 0;
+  int hi = n;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (*(int*)((char*)&stop[mid] + field) <= pos)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo == 0 ? NULL : &stop[lo - 1];
+}
+
+/* Text byte of render byte rb of a rendered row that isn't a rope, the
+ * start of the character it's part of. */
+static int rowRbToCx(row* row, int rb) {
+  charStop* s = rowStopAt(row, offsetof(charStop, rb), rb);
+  if (s == NULL)
+    return rb;
+  if (rb < s->rb + s->rlen)
+    return s->cx;
+  return s->cx + s->len + rb - s->rb - s->rlen;
+}
+
+/* Render byte of the first character of a rendered row that starts at
+ * column rx or after, and in *pad the columns from rx to it: a wide one
+ * that rx cuts is left out. */
+static int rowRenderOffset(row* row, int rx, int* pad) {
+  int roff = (row->flags & ROW_ROPE) ? row->roff : 0;
+  charStop* s = rowStopAt(row, offsetof(charStop, rx), rx);
+  int rb;
+  *pad = 0;
+  if (s == NULL) {
+    rb = rx - roff;
+  } else if (rx >= s->rx + s->width) {
+    rb = s->rb + s->rlen + rx - s->rx - s->width;
+  } else if (s->len == 1) {
+    /* a tab, the only one byte stop, its spaces can be cut anywhere */
+    rb = s->rb + rx - s->rx;
+  } else if (rx == s->rx) {
+    rb = s->rb;
+  } else {
+    rb = s->rb + s->rlen;
+    *pad = s->rx + s->width - rx;
+  }
+  if (rb < 0)
+    rb = 0;
+  return rb < row->rsize ? rb : row->rsize;
+}
+
+/* Byte at of a row, whatever holds its text. */
+static char rowByte(row* row, int at) {
+  char c;
+  if (!(row->flags & ROW_ROPE))
+    return ROW_CHAR(row, at);
+  ropeCopy(row->rope, at, 1, &c);
+  return c;
+}
+
+/* Bytes of the character at byte at of a row and its code point in *cp,
+ * see utf8Char. */
+static int rowCharAt(row* row, int at, int* cp) {
+  char tmp[UTF8_MAX];
+  int n = row->size - at < UTF8_MAX ? row->size - at : UTF8_MAX;
+  if (row->flags & ROW_ROPE) {
+    ropeCopy(row->rope, at, n, tmp);
+  } else {
+    for (int k = 0; k < n; k++)
+      tmp[k] = ROW_CHAR(row, at + k);
+  }
+  return utf8Char(tmp, n, cp);
+}
+
+/* Byte after the character at byte at of a row and the marks drawn on it,
+ * where the cursor goes next. */
+static int rowNextChar(row* row, int at) {
+  int cp;
+  if (at >= row->size)
+    return row->size;
+  at += rowCharAt(row, at, &cp);
+  while (at < row->size) {
+    int len = rowCharAt(row, at, &cp);
+    if (cp < 0 || utf8Width(cp) != 0)
+      break;
+    at += len;
+  }
+  return at;
+}
+
+/* Start of the character before byte at of a row, or of the one the marks
+ * before at are drawn on. */
+static int rowPrevChar(row* row, int at) {
+  while (at > 0) {
+    /* the lead byte is at most UTF8_MAX - 1 continuation bytes back */
+    int j = at - 1;
+    while (j > 0 && at - j < UTF8_MAX && (rowByte(row, j) & 0xc0) == 0x80)
+      j--;
+    int cp;
+    if (rowCharAt(row, j, &cp) != at - j) {
+      j = at - 1;
+      cp = -1;
+    }
+    if (j == 0 || cp < 0 || utf8Width(cp) != 0)
+      return j;
+    at = j;
+  }
+  return 0;
+}
+
+/* Byte at moved back to the start of the character it's in, or of the one
+ * it's a mark of. */
+static int rowCharStart(row* row, int at) {
+  if (at <= 0 || at >= row->size)
+    return at;
+  int j = at;
+  while (j > 0 && at - j < UTF8_MAX - 1 && (rowByte(row, j) & 0xc0) == 0x80)
+    j--;
+  int cp;
+  int len = rowCharAt(row, j, &cp);
+  if (j < at && j + len > at)
+    at = j;
+  else
+    len = rowCharAt(row, at, &cp);
+  if (cp >= 0 && utf8Width(cp) == 0)
+    at = rowPrevChar(row, at + len);
+  return at;
+}
+
+/* Heap taken by an n byte allocation, as glibc malloc rounds it. */
+static long heapBytes(long n) {
+  if (n <= 0)
+    return 0;
+  n = (n + sizeof(size_t) + 15) & ~15L;
+  return n < 32 ? 32 : n;
+}
+
+/* How rows were laid out before text could be embedded and renders aliased,
+ * to compare against. */
+typedef struct flatRow {
+  int size;
+  char* chars;
+  int gap, gaplen, rsize, roff;
+  char* render;
+  unsigned char* hl;
+  int flags;
+} flatRow;
+
+/* :mem, bytes per row now and with every text and render on its own in
+ * the malloc heap */
+void editorMemReport(editorConfig* E) {
+  long flat = 0;
+  long text = 0;
+  long render = 0;
+  rowIter it;
+  for (row* row = rowTreeSeek(&E->rows, 0, &it); row; row = rowTreeNext(&it)) {
+    if (row->flags & ROW_ROPE) {
+      text += row->size;
+      flat += row->size;
+    } else if (row->flags & ROW_EMBED) {
+      flat += heapBytes(row->size + 1);
+    } else if (!(row->flags & ROW_SHARED)) {
+      text += poolSize(row->size + row->gaplen);
+      flat += heapBytes(row->size + 1);
+    }
+    if (row->flags & ROW_RENDERED) {
+      render += poolSize(rowBlockBytes(row));
+      flat += heapBytes(row->rsize) + heapBytes(row->rsize + 1);
+    }
+  }
+  long now = (long)sizeof(row) * E->numrows + text + render;
+  flat += (long)sizeof(flatRow) * E->numrows;
+  int n = E->numrows ? E->numrows : 1;
+  setStatusMessage(E, "%.1f B/line (row %d, text %.1f, render %.1f), was %.1f",
+                   (double)now / n, (int)sizeof(row), (double)text / n,
+                   (double)render / n, (double)flat / n);
+}
+
+static void rowDrop(row* row) {
+  poolFree(row->hl, rowBlockBytes(row));
+  row->hl = NULL;
+  row->rsize = 0;
+  row->flags &= ~(ROW_RENDERED | ROW_ALIAS);
+}
+
+/* Drop the render of the oldest cached row that's off screen. */
+static void renderCacheEvict(editorConfig* E) {
+  for (int tries = E->cachelen; tries > 0; tries--) {
+    int at = E->cache[E->cachehead];
+    E->cachehead = (E->cachehead + 1) % E->cachecap;
+    E->cachelen--;
+    if (at == -1)
+      return;
+    if (at >= E->rowoff && at < E->rowoff + E->screenrows) {
+      /* still needed, requeue it */
+      E->cache[(E->cachehead + E->cachelen++) % E->cachecap] = at;
+      continue;
+    }
+    rowDrop(editorRow(E, at));
+    return;
+  }
+}
+
+static void renderCacheAdd(editorConfig* E, int at) {
+  if (E->cachelen == E->cachecap)
+    renderCacheEvict(E);
+  if (E->cachelen == E->cachecap) {
+    /* everything is on screen, make room */
+    int cap = E->cachecap ? E->cachecap * 2 : RENDER_CACHE_ROWS;
+    int* cache = malloc(sizeof(int) * cap);
+    check(cache == NULL, "Fail to allocate render cache");
+    for (int k = 0; k < E->cachelen; k++)
+      cache[k] = E->cache[(E->cachehead + k) % E->cachecap];
+    free(E->cache);
+    E->cache = cache;
+    E->cachecap = cap;
+    E->cachehead = 0;
+  }
+  E->cache[(E->cachehead + E->cachelen++) % E->cachecap] = at;
+}
+
+/* Rows from at on moved by delta, row at itself was deleted if delta < 0. */
+static void renderCacheShift(editorConfig* E, int at, int delta) {
+  for (int k = 0; k < E->cachelen; k++) {
+    int* slot = &E->cache[(E->cachehead + k) % E->cachecap];
+    if (*slot == -1 || *slot < at)
+      continue;
+    if (delta < 0 && *slot == at)
+      *slot = -1;
+    else
+      *slot += delta;
+  }
+}
+
+/* Drop every render, e.g. when the highlighting changes. */
+static void renderCacheClear(editorConfig* E) {
+  for (int k = 0; k < E->cachelen; k++) {
+    int at = E->cache[(E->cachehead + k) % E->cachecap];
+    if (at != -1)
+      rowDrop(editorRow(E, at));
+  }
+  E->cachelen = 0;
+}
+
+/* :set tabstop, which every render and rope measure depends on. */
+void editorSetTabWidth(editorConfig* E, int width) {
+  if (width < 1 || width > TAB_WIDTH_MAX) {
+    setStatusMessage(E, "tabstop goes from 1 to %d", TAB_WIDTH_MAX);
+    return;
+  }
+  tabWidth = width;
+  rowIter it;
+  row* row = rowTreeSeek(&E->rows, 0, &it);
+  for (; row; row = rowTreeNext(&it)) {
+    if (row->flags & ROW_ROPE)
+      ropeMeasure(row->rope);
+  }
+  renderCacheClear(E);
+}
+
 void editorFind(editorConfig* E, char* query) {
   int saved_cx = E->cx;
   int saved_cy = E->cy;
   int saved_coloff = E->coloff;
   int saved_rowoff = E->rowoff;
 
+  editorLoadWait(E, INT_MAX);
   editorFindAll(E, query);
   editorFindForward(E, query);
   while (1) {
@@ -201,7 +861,7 @@ void editorFind(editorConfig* E, char* query) {
       break;
     }
   }
-  editorFindQuit(E, query);
+  editorFindQuit(E);
   E->cx = saved_cx;
   E->cy = saved_cy;
   E->coloff = saved_coloff;
@@ -209,46 +869,63 @@ void editorFind(editorConfig* E, char* query) {
   E->searchResultRow = -1;
 }
 
-void editorFindQuit(editorConfig* E, char* query) {
-  for (int i = 0; i < E->numrows; i++) {
-    row* row = &E->data[i];
-    char* match = strstr(row->render, query);
-    if (match) {
-      /* match highlight */
-      memset(&row->hl[match - row->render], HL_NORMAL, strlen(query));
-    }
-  }
+void editorFindQuit(editorConfig* E) {
+  E->query = NULL;
+  renderCacheClear(E);
   renderScreen(E);
 }
 
-void editorFindAll(editorConfig* E, char* query) {
-  for (int i = 0; i < E->numrows; i++) {
-    row* row = &E->data[i];
-    char* match = strstr(row->render, query);
-    if (match) {
-      /* match highlight */
-      memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
-    }
+/* First occurrence of query in the n bytes at s, which needn't end in a
+ * NUL, or NULL. */
+static char* memfind(char* s, int n, const char* query) {
+  int qlen = strlen(query);
+  if (qlen == 0)
+    return s;
+  for (int i = 0; i + qlen <= n; i++) {
+    char* p = memchr(&s[i], query[0], n - qlen - i + 1);
+    if (p == NULL)
+      return NULL;
+    if (memcmp(p, query, qlen) == 0)
+      return p;
+    i = p - s;
   }
+  return NULL;
+}
+
+static int rowRenderFind(row*, const char*);
+
+/* Byte of the first match of query in row number at, or -1. Rope rows
+ * are searched in their text, only their visible part is rendered. */
+static int rowFind(editorConfig* E, row* row, int at, char* query) {
+  if (row->flags & ROW_ROPE)
+    return ropeFind(row->rope, query);
+  rowMaterialize(E, row, at);
+  int rb = rowRenderFind(row, query);
+  return rb != -1 ? rowRbToCx(row, rb) : -1;
+}
+
+void editorFindAll(editorConfig* E, char* query) {
+  /* matches get highlighted as rows are rendered, see rowRender */
+  E->query = query;
+  renderCacheClear(E);
   renderScreen(E);
 }
 
 void editorFindForward(editorConfig* E, char* query) {
-  for (int i = E->searchResultRow + 1; i < E->numrows; i++) {
-    row* row = &E->data[i];
-    char* match = strstr(row->render, query);
-    if (match) {
+  rowIter it;
+  row* row = rowTreeSeek(&E->rows, E->searchResultRow + 1, &it);
+  for (int i = E->searchResultRow + 1; row; i++, row = rowTreeNext(&it)) {
+    int cx = rowFind(E, row, i, query);
+    if (cx != -1) {
       E->searchResultRow = i;
       E->cy = i;
-      E->cx = rowRxToCx(row, match - row->render);
+      E->cx = cx;
       int diff = (E->cy - E->rowoff) - (E->screenrows / 2);
       if ((diff > 0) && (E->rowoff + diff < E->numrows)) {
         E->rowoff += diff;
       } else if ((diff < 0) && (E->rowoff + diff > 0)) {
         E->rowoff += diff;
       }
-      /* match highlight */
-      memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
       renderScreen(E);
       break;
     }
@@ -256,13 +933,14 @@ void editorFindForward(editorConfig* E, char* query) {
 }
 
 void editorFindBackward(editorConfig* E, char* query) {
-  for (int i = E->searchResultRow - 1; i >= 0; i--) {
-    row* row = &E->data[i];
-    char* match = strstr(row->render, query);
-    if (match) {
+  rowIter it;
+  row* row = rowTreeSeek(&E->rows, E->searchResultRow - 1, &it);
+  for (int i = E->searchResultRow - 1; row; i--, row = rowTreePrev(&it)) {
+    int cx = rowFind(E, row, i, query);
+    if (cx != -1) {
       E->searchResultRow = i;
       E->cy = i;
-      E->cx = rowRxToCx(row, match - row->render);
+      E->cx = cx;
       int diff = (E->cy - E->rowoff) - (E->screenrows / 2);
       if ((diff > 0) && (E->rowoff + diff < E->numrows)) {
         E->rowoff += diff;
@@ -275,123 +953,760 @@ void editorFindBackward(editorConfig* E, char* query) {
   }
 }
 
+static void editorAddRows(editorConfig*, int, row*, int);
+static void rowFit(editorConfig*, row*);
+static void rowRender(editorConfig*, row*);
+static void rowGapMove(row*, int);
+static void rowHighlight(editorConfig*, row*);
+static unsigned char syntaxOf(unsigned char);
+
+/* Heap text for row->size bytes, to be filled in by the caller. The gap is
+ * at the end and takes whatever the pool rounds the block up to. */
+static char* rowAllocText(row* row) {
+  size_t cap = poolSize(row->size + 1);
+  row->gap = row->size;
+  row->gaplen = cap - row->size;
+  return poolAlloc(cap);
+}
+
+/* Free the heap text of a row, before its gap changes. */
+static void rowFreeText(row* row, char* chars) {
+  poolFree(chars, row->size + row->gaplen);
+}
+
+/* Set up r with a copy of len bytes of s, it's not in the editor yet. */
+static void rowInit(editorConfig* E, row* r, const char* s, size_t len) {
+  r->size = len;
+  if (E->engine == ENGINE_PIECES) {
+    r->chars = (char*)pieceAppend(&E->pieces, s, len);
+    r->gap = len;
+    r->gaplen = 0;
+    r->flags = ROW_SHARED;
+  } else if (len <= ROW_EMBED_SIZE) {
+    memcpy(r->embed, s, len);
+    r->gap = len;
+    r->gaplen = ROW_EMBED_SIZE - len;
+    r->flags = ROW_EMBED;
+  } else {
+    r->chars = rowAllocText(r);
+    memcpy(r->chars, s, len);
+    r->flags = 0;
+  }
+}
+
 void insertRow(editorConfig* E, int at, char* s, size_t len) {
   if (at < 0 || at > E->numrows)
     return;
-  E->data = realloc(E->data, sizeof(row) * (E->numrows + 1));
-  memmove(&E->data[at + 1], &E->data[at], sizeof(row) * (E->numrows - at));
-
-  E->data[at].size = len;
-  E->data[at].chars = malloc(len + 1);
-  memcpy(E->data[at].chars, s, len);
-  E->data[at].chars[len] = '\0';
 
-  /* For render TAB */
-  E->data[at].rsize = 0;
-  E->data[at].render = NULL;
+  /* s may point into another row, copy it before rows move */
+  row r;
+  rowInit(E, &r, s, len);
+  editorAddRows(E, at, &r, 1);
+}
 
-  E->data[at].hl = NULL;
-  updateRow(E, &E->data[at]);
+/* Put the n new rows r, text already set, at positions at, at + 1, ... */
+static void editorAddRows(editorConfig* E, int at, row* r, int n) {
+  editorCommitHot(E);
+  for (int i = 0; i < n; i++) {
+    /* For render TAB */
+    r[i].rsize = 0;
+    r[i].hl = NULL;
+    /* rendered once it's on screen */
+    rowFit(E, rowTreeInsert(&E->rows, at + i, &r[i]));
+  }
+  if (at < E->numrows)
+    renderCacheShift(E, at, n);
 
-  E->numrows++;
+  E->numrows += n;
   /* TODO: how dirty this file is?
   maybe write it back when dirtyness
   exceed some threshold? performance tuning */
   E->dirty++;
 }
 
-void updateRow(editorConfig* E, row* row) {
-  int tabs = 0;
-  int j;
-  for (j = 0; j < row->size; j++) {
-    if (row->chars[j] == '\t')
-      tabs++;
-  }
-
-  free(row->render);
-  row->render = malloc(row->size + tabs * (TAB_WIDTH - 1) + 1);
-
-  int idx = 0;
-  for (j = 0; j < row->size; j++) {
-    if (row->chars[j] == '\t') {
-      row->render[idx++] = ' ';
-      while (idx % TAB_WIDTH != 0)
-        row->render[idx++] = ' ';
+/* Turn a row's text into a rope. Mapped text is referenced, not copied. */
+static void rowToRope(row* row) {
+  rope* text;
+  if (row->flags & ROW_SHARED) {
+    text = ropeBuild(row->chars, row->size, 0);
+  } else {
+    char* chars = rowChars(row);
+    text = ropeBuild(chars, row->size, 1);
+    if (!(row->flags & ROW_EMBED))
+      rowFreeText(row, chars);
+  }
+  row->rope = text;
+  row->roff = 0;
+  row->gap = 0;
+  row->gaplen = 0;
+  row->flags = (row->flags & ~(ROW_SHARED | ROW_EMBED)) | ROW_ROPE;
+}
+
+static void rowFromRope(row* row) {
+  rope* text = row->rope;
+  char* chars = rowAllocText(row);
+  ropeCopy(text, 0, row->size, chars);
+  ropeFree(text);
+  row->chars = chars;
+  row->flags &= ~ROW_ROPE;
+}
+
+/* Move a row's text into the row itself, saving an allocation. */
+static void rowToEmbed(row* row) {
+  int shared = row->flags & ROW_SHARED;
+  char* chars = shared ? row->chars : rowChars(row);
+  memcpy(row->embed, chars, row->size);
+  if (!shared)
+    rowFreeText(row, chars);
+  row->gap = row->size;
+  row->gaplen = ROW_EMBED_SIZE - row->size;
+  row->flags = (row->flags & ~ROW_SHARED) | ROW_EMBED;
+}
+
+/* ENGINE_ROWS keeps rows of at least ROPE_ROW_MIN bytes as ropes and rows
+ * of at most ROW_EMBED_SIZE bytes in place. Rows go back to a plain gap
+ * buffer once they're well past either limit, so that editing around it
+ * doesn't convert them back and forth. */
+static void rowFit(editorConfig* E, row* row) {
+  if (E->engine != ENGINE_ROWS)
+    return;
+  if (!(row->flags & ROW_ROPE) && row->size >= ROPE_ROW_MIN)
+    rowToRope(row);
+  else if ((row->flags & ROW_ROPE) && row->size < ROPE_ROW_MIN / 2)
+    rowFromRope(row);
+  else if (!(row->flags & (ROW_ROPE | ROW_EMBED)) &&
+           row->size <= ((row->flags & ROW_SHARED) ? ROW_EMBED_SIZE
+                                                    : ROW_EMBED_SIZE / 2))
+    rowToEmbed(row);
+}
+
+/* Size a row's highlight for rsize render bytes, followed by its render
+ * and room for stops char stops unless alias: one block holds all of it,
+ * reused as long as it rounds to the same size. Returns the render. */
+static char* rowRenderAlloc(row* row, int rsize, int alias, int stops) {
+  int n = rowRenderBytes(rsize, alias, stops);
+  if (row->hl == NULL)
+    row->hl = poolAlloc(n);
+  else
+    row->hl = poolRealloc(row->hl, rowBlockBytes(row), n);
+  row->rsize = rsize;
+  row->flags = (row->flags & ~ROW_ALIAS) | ROW_RENDERED | alias;
+  if (alias)
+    return (char*)&row->hl[rsize];
+  *(int*)&row->hl[rowStopsOffset(rsize)] = stops;
+  return (char*)&row->hl[rowRenderCap(rsize)];
+}
+
+/* How far laying text out into a render has got, in the text, the render
+ * and the columns, and the char stops it made. Without a render the text
+ * is only measured. */
+typedef struct layout {
+  int cx;
+  int rb;
+  int rx;
+  int stops;
+  int plain; /* all ASCII without tabs so far */
+  char* render;
+  charStop* stop;
+} layout;
+
+/* Lay out the n bytes at text after what l went through already, a run of
+ * plain ASCII at a time: tabs become spaces and bytes that aren't a
+ * character '?'. */
+static void layoutText(layout* l, const char* text, int n) {
+  int j = 0;
+  while (j < n) {
+    /* the render has room for the rest of text, a byte takes one or more */
+    int k = l->render ? utf8Copy(&l->render[l->rb], &text[j], n - j)
+                      : utf8Span(&text[j], n - j);
+    l->cx += k;
+    l->rb += k;
+    l->rx += k;
+    j += k;
+    if (j == n)
+      break;
+
+    int len = 1;
+    int rlen, width, cp;
+    char* out = l->render ? &l->render[l->rb] : NULL;
+    if (text[j] == '\t') {
+      rlen = width = tabColumns(l->rx);
+      if (out)
+        memset(out, ' ', rlen);
     } else {
-      row->render[idx++] = row->chars[j];
+      len = rlen = utf8Char(&text[j], n - j, &cp);
+      width = utf8Width(cp);
+      if (out && cp < 0)
+        *out = '?';
+      else if (out)
+        memcpy(out, &text[j], len);
+    }
+    l->plain = 0;
+    if (len != 1 || rlen != 1 || width != 1) {
+      if (l->stop)
+        *l->stop++ = (charStop){l->cx, l->rb, l->rx, len, rlen, width};
+      l->stops++;
     }
+    l->cx += len;
+    l->rb += rlen;
+    l->rx += width;
+    j += len;
   }
-  row->render[idx] = '\0';
-  row->rsize = idx;
+}
+
+/* Render the part of a rope row on screen, from the character under
+ * E->coloff on, instead of the whole row. */
+static void rowRenderWindow(editorConfig* E, row* row) {
+  int width = E->screencols - LINE_NUMBER_WIDTH;
+  if (width < 0)
+    width = 0;
+  int from = ropeByteAt(row->rope, E->coloff);
+  int col = ropeColumn(row->rope, from);
+  /* col is less than a tab before coloff, and a character takes a column
+   * for at most UTF8_MAX bytes, marks aside */
+  int n = row->size - from;
+  if (n > (width + tabWidth) * UTF8_MAX)
+    n = (width + tabWidth) * UTF8_MAX;
+
+  char* text = poolAlloc(n + 1);
+  ropeCopy(row->rope, from, n, text);
+  /* columns start from the rope's, the stops are only for drawing */
+  layout l = {0, 0, col, 0, 1, NULL, NULL};
+  layoutText(&l, text, n);
+  char* render = rowRenderAlloc(row, l.rb, 0, l.stops);
+
+  row->roff = col;
+  int stops;
+  layout fill = {0, 0, col, 0, 1, render, rowStops(row, &stops)};
+  layoutText(&fill, text, n);
+  render[fill.rb] = '\0';
+  poolFree(text, n + 1);
 
   updateSyntax(row);
 }
 
+/* Called after a row's text changed. Only rows with a render are redone,
+ * the others wait for rowMaterialize. */
+void updateRow(editorConfig* E, row* row) {
+  rowFit(E, row);
+  /* a rope's window is rebuilt by rowMaterialize anyway */
+  if (!(row->flags & ROW_RENDERED) || (row->flags & ROW_ROPE))
+    return;
+  rowRender(E, row);
+}
+
+/* What's displayed for a rendered row, in two pieces of seglen bytes: the
+ * render after its highlight, or its text on both sides of the gap when
+ * the two are the same, which the gap stays open for. */
+void rowRenderSegments(row* row, char* seg[2], int seglen[2]) {
+  if (row->flags & ROW_ALIAS) {
+    char* text = ROW_TEXT(row);
+    seg[0] = text;
+    seglen[0] = row->gap;
+    seg[1] = &text[row->gap + row->gaplen];
+    seglen[1] = row->size - row->gap;
+    return;
+  }
+  seg[0] = (char*)&row->hl[rowRenderCap(row->rsize)];
+  seglen[0] = row->rsize;
+  seg[1] = NULL;
+  seglen[1] = 0;
+}
+
+/* Render byte of the first match of query in a rendered row, -1 if none.
+ * One across an alias row's gap is looked for from the qlen - 1 bytes
+ * before it. */
+static int rowRenderFind(row* row, const char* query) {
+  char* seg[2];
+  int seglen[2];
+  rowRenderSegments(row, seg, seglen);
+  char* match = memfind(seg[0], seglen[0], query);
+  if (match)
+    return match - seg[0];
+  if (seglen[1] == 0)
+    return -1;
+  int qlen = strlen(query);
+  int from = seglen[0] > qlen - 1 ? seglen[0] - (qlen - 1) : 0;
+  for (int i = from; i < seglen[0]; i++) {
+    int head = seglen[0] - i;
+    if (qlen - head <= seglen[1] && memcmp(&seg[0][i], query, head) == 0 &&
+        memcmp(seg[1], &query[head], qlen - head) == 0)
+      return i;
+  }
+  match = memfind(seg[1], seglen[1], query);
+  return match ? seglen[0] + (match - seg[1]) : -1;
+}
+
+static void rowRender(editorConfig* E, row* row) {
+  /* a character the gap cuts in two would be laid out as two bad bytes,
+   * the gap goes before it */
+  if (row->gap < row->size && (ROW_CHAR(row, row->gap) & 0xc0) == 0x80) {
+    int at = row->gap;
+    for (int k = 0; k < UTF8_MAX - 1 && at > 0; k++) {
+      if ((ROW_TEXT(row)[--at] & 0xc0) != 0x80)
+        break;
+    }
+    rowGapMove(row, at);
+  }
+
+  /* both sides of the gap, without closing it */
+  char* text = ROW_TEXT(row);
+  char* seg[2] = {text, &text[row->gap + row->gaplen]};
+  int seglen[2] = {row->gap, row->size - row->gap};
+
+  layout l = {0, 0, 0, 0, 1, NULL, NULL};
+  layoutText(&l, seg[0], seglen[0]);
+  layoutText(&l, seg[1], seglen[1]);
+  /* plain, the render would be a copy of the text */
+  char* render = rowRenderAlloc(row, l.rb, l.plain ? ROW_ALIAS : 0, l.stops);
+  if (l.plain) {
+    rowHighlight(E, row);
+    return;
+  }
+
+  int stops;
+  layout fill = {0, 0, 0, 0, 1, render, rowStops(row, &stops)};
+  layoutText(&fill, seg[0], seglen[0]);
+  layoutText(&fill, seg[1], seglen[1]);
+  render[fill.rb] = '\0';
+  rowHighlight(E, row);
+}
+
+static void rowHighlight(editorConfig* E, row* row) {
+  updateSyntax(row);
+  if (E->query) {
+    int rb = rowRenderFind(row, E->query);
+    if (rb != -1) {
+      /* match highlight */
+      memset(&row->hl[rb], HL_MATCH, strlen(E->query));
+    }
+  }
+}
+
+/* First byte ch of a row's gap buffer at or after from, row->size if
+ * there's none. */
+static int rowFindByte(row* row, int from, int ch) {
+  char* text = ROW_TEXT(row);
+  if (from < row->gap) {
+    char* p = memchr(&text[from], ch, row->gap - from);
+    if (p)
+      return p - text;
+    from = row->gap;
+  }
+  char* tail = &text[row->gaplen];
+  char* p = memchr(&tail[from], ch, row->size - from);
+  return p ? p - tail : row->size;
+}
+
+/* Patch the render of a row that isn't a rope for the byte c just inserted
+ * at text byte at (delta 1), or deleted from there (delta -1), instead of
+ * laying it all out again: the rest of the render moves by a byte, or only
+ * up to the next tab, which gives or takes the column from its spaces.
+ * Returns 0 when c isn't plain ASCII or the tab can't, for rowRender. */
+static int rowPatch(editorConfig* E, row* row, int at, int c, int delta) {
+  if (c < 0 || c >= 0x80 || c == '\t')
+    return 0;
+  /* a character cut in two or put back together */
+  int next = delta > 0 ? at + 1 : at;
+  if (next < row->size && (ROW_CHAR(row, next) & 0xc0) == 0x80)
+    return 0;
+
+  int rsize = row->rsize;
+  if (row->flags & ROW_ALIAS) {
+    /* the render is the text, only the highlight moves */
+    if (delta > 0)
+      row->hl = poolRealloc(row->hl, rsize + 1, rsize + 2);
+    memmove(&row->hl[at + (delta > 0)], &row->hl[at + (delta < 0)],
+            rsize - at - (delta < 0));
+    if (delta < 0)
+      row->hl = poolRealloc(row->hl, rsize + 1, rsize);
+    else
+      row->hl[at] = syntaxOf(c);
+    row->rsize += delta;
+    if (E->query)
+      rowHighlight(E, row);
+    return 1;
+  }
+
+  /* the first tab after the edit, old text bytes from here on */
+  int tab = tabWidth > 1 ? rowFindByte(row, next, '\t') : row->size;
+  tab -= delta;
+  int n;
+  charStop* stop = rowStops(row, &n);
+  charStop* s = rowStopAt(row, offsetof(charStop, cx), at - 1);
+  int k = s ? s - stop + 1 : 0;
+  int rb = s ? s->rb + s->rlen + at - s->cx - s->len : at;
+  charStop* t = NULL;
+  if (tab < row->size - delta) {
+    t = rowStopAt(row, offsetof(charStop, cx), tab);
+    /* a tab of one column has no stop, it can't get or lose one here */
+    if (t == NULL || t->cx != tab || t->width - delta < 2 ||
+        t->width - delta > tabWidth)
+      return 0;
+  } else if (rowRenderCap(rsize + delta) != rowRenderCap(rsize)) {
+    return 0;
+  }
+
+  char* render = (char*)&row->hl[rowRenderCap(rsize)];
+  /* the tab's first byte, or the end with the render's nul */
+  int end = t ? t->rb : rsize + 1;
+  if (delta > 0) {
+    memmove(&render[rb + 1], &render[rb], end - rb);
+    memmove(&row->hl[rb + 1], &row->hl[rb], end - rb - !t);
+    render[rb] = c;
+    row->hl[rb] = syntaxOf(c);
+  } else {
+    memmove(&render[rb], &render[rb + 1], end - rb - 1);
+    memmove(&row->hl[rb], &row->hl[rb + 1], end - rb - 1 - !t);
+    if (t) {
+      render[end - 1] = ' ';
+      row->hl[end - 1] = HL_NORMAL;
+    }
+  }
+
+  int last = t ? t - stop : n;
+  for (int j = k; j < n; j++) {
+    stop[j].cx += delta;
+    if (j <= last) {
+      stop[j].rb += delta;
+      stop[j].rx += delta;
+    }
+  }
+  if (t) {
+    t->rlen -= delta;
+    t->width -= delta;
+  } else {
+    row->rsize += delta;
+  }
+  if (E->query)
+    rowHighlight(E, row);
+  return 1;
+}
+
+/* updateRow after the one byte c was inserted at byte at of row (delta 1)
+ * or deleted from there (delta -1), patching the render when it can. */
+static void updateRowEdit(editorConfig* E,
+                          row* row,
+                          int at,
+                          int c,
+                          int delta) {
+  /* a rope only had a window rendered */
+  int rope = row->flags & ROW_ROPE;
+  rowFit(E, row);
+  if (!(row->flags & ROW_RENDERED) || (row->flags & ROW_ROPE))
+    return;
+  if (rope || !rowPatch(E, row, at, c, delta))
+    rowRender(E, row);
+}
+
 void insertNewLine(editorConfig* E) {
   if (E->cx == 0) {
     insertRow(E, E->cy, "", 0);
   } else {
-    row* row = &E->data[E->cy];
-    insertRow(E, E->cy + 1, &row->chars[E->cx], row->size - E->cx);
-    row = &E->data[E->cy];
-    row->size = E->cx;
-    row->chars[row->size] = '\0';
+    row* row = editorRow(E, E->cy);
+    if (row->flags & ROW_ROPE) {
+      /* the tail of a rope moves to the new row as is */
+      struct row r;
+      rope* tail;
+      row->rope = ropeSplit(row->rope, E->cx, &tail);
+      r.rope = tail;
+      r.roff = 0;
+      r.size = row->size - E->cx;
+      r.gap = 0;
+      r.gaplen = 0;
+      r.flags = ROW_ROPE;
+      rowTreeResize(row, E->cx - row->size);
+      row->size = E->cx;
+      editorAddRows(E, E->cy + 1, &r, 1);
+    } else {
+      char* chars = rowChars(row);
+      insertRow(E, E->cy + 1, &chars[E->cx], row->size - E->cx);
+      row = editorRow(E, E->cy);
+      rowTouch(E, row);
+      /* the gap is at the end, let it swallow the tail */
+      rowTreeResize(row, E->cx - row->size);
+      row->gaplen += row->size - E->cx;
+      row->size = E->cx;
+      row->gap = E->cx;
+    }
   }
-  updateRow(E, &E->data[E->cy]);
+  updateRow(E, editorRow(E, E->cy));
   E->cy++;
   E->cx = 0;
 }
 
-void rowInsertChar(editorConfig* E, row* row, int at, int c) {
-  if (at < 0 || at >= row->size)
-    at = row->size - 1;
-  row->chars = realloc(row->chars, row->size + 1);
-  memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-  row->size++;
-  row->chars[at] = c;
+/* Move the gap so that it starts at text position at, only the bytes
+ * between the old and new position move. */
+static void rowGapMove(row* row, int at) {
+  char* text = ROW_TEXT(row);
+  if (at < row->gap) {
+    memmove(&text[at + row->gaplen], &text[at], row->gap - at);
+  } else if (at > row->gap) {
+    memmove(&text[row->gap], &text[row->gap + row->gaplen], at - row->gap);
+  }
+  row->gap = at;
+}
+
+/* Make room for at least n more characters, growing the gap to about the
+ * row size so repeated inserts are amortized O(1). */
+static void rowGapReserve(row* row, int n) {
+  if (row->gaplen >= n)
+    return;
+  int gaplen = row->size > ROW_GAP_MIN ? row->size : ROW_GAP_MIN;
+  if (gaplen < n)
+    gaplen = n;
+  /* the pool rounds the block up anyway */
+  gaplen = poolSize(row->size + gaplen) - row->size;
+  int tail = row->size - row->gap;
+  char* chars;
+  if (row->flags & ROW_EMBED) {
+    /* outgrew the row, move to the heap */
+    chars = poolAlloc(row->size + gaplen);
+    memcpy(chars, row->embed, row->gap);
+    memcpy(&chars[row->gap + gaplen], &row->embed[row->gap + row->gaplen],
+           tail);
+    row->flags &= ~ROW_EMBED;
+  } else {
+    chars = poolRealloc(row->chars, row->size + row->gaplen,
+                        row->size + gaplen);
+    memmove(&chars[row->gap + gaplen], &chars[row->gap + row->gaplen], tail);
+  }
+  row->chars = chars;
+  row->gaplen = gaplen;
+}
+
+/* Insert len bytes of s before byte at of row, without rendering it. */
+static void rowInsertString(editorConfig* E,
+                            row* row,
+                            int at,
+                            const char* s,
+                            int len) {
+  rowTouch(E, row);
+  if (row->flags & ROW_ROPE) {
+    row->rope = ropeInsert(row->rope, at, s, len);
+  } else {
+    rowGapReserve(row, len);
+    rowGapMove(row, at);
+    memcpy(&ROW_TEXT(row)[row->gap], s, len);
+    row->gap += len;
+    row->gaplen -= len;
+  }
+  row->size += len;
+  rowTreeResize(row, len);
   E->dirty++;
 }
 
+/* Insert byte c before byte at of row, at its start or end if at is out
+ * of it. Returns where c went. */
+int rowInsertChar(editorConfig* E, row* row, int at, int c) {
+  if (at > row->size)
+    at = row->size;
+  if (at < 0)
+    at = 0;
+  char ch = c;
+  rowInsertString(E, row, at, &ch, 1);
+  return at;
+}
+
+/* Bytes of the UTF-8 character lead byte c starts, 1 if it doesn't. */
+static int utf8Length(unsigned char c) {
+  if (c >= 0xf8)
+    return 1;
+  if (c >= 0xf0)
+    return 4;
+  if (c >= 0xe0)
+    return 3;
+  return c >= 0xc0 ? 2 : 1;
+}
+
 void insertChar(editorConfig* E, int c) {
+  /* a character's bytes come in as keys one at a time, it goes in whole
+   * at the cursor once they're all there */
+  if (c >= 0x80 && c <= 0xff) {
+    if (c >= 0xc0)
+      E->typedlen = 0;
+    E->typed[E->typedlen++] = c;
+    if (E->typedlen < utf8Length(E->typed[0]))
+      return;
+    editorInsertText(E, E->typed, E->typedlen);
+    E->typedlen = 0;
+    return;
+  }
   if (E->cy == E->numrows) {
     insertRow(E, E->numrows, "", 0);
   }
-  rowInsertChar(E, &E->data[E->cy], E->cx, c);
-  updateRow(E, &E->data[E->cy]);
+  row* row = editorRow(E, E->cy);
+  int at = rowInsertChar(E, row, E->cx, c);
+  updateRowEdit(E, row, at, (unsigned char)c, 1);
   E->cx++;
 }
 
 void freerow(row* row) {
-  free(row->chars);
-  free(row->render);
-  free(row->hl);
+  if (row->flags & ROW_ROPE)
+    ropeFree(row->rope);
+  else if (!(row->flags & (ROW_SHARED | ROW_EMBED)))
+    rowFreeText(row, row->chars);
+  if (row->hl)
+    poolFree(row->hl, rowBlockBytes(row));
+}
+
+void rowDetach(row* row) {
+  /* copy-on-write: give a mapped row its own heap copy */
+  if (!(row->flags & ROW_SHARED))
+    return;
+  char* chars = rowAllocText(row);
+  memcpy(chars, row->chars, row->size);
+  row->chars = chars;
+  row->flags &= ~ROW_SHARED;
+}
+
+/* Contiguous view of the row text: closes the gap by moving it to the end.
+ * Not for ROW_ROPE rows. */
+char* rowChars(row* row) {
+  rowGapMove(row, row->size);
+  return ROW_TEXT(row);
+}
+
+/* Called before a row's text changes. ENGINE_PIECES keeps at most one row
+ * with heap text, the previously edited one is committed first. */
+void rowTouch(editorConfig* E, row* row) {
+  /* a big mapped row becomes a rope referencing the mapping, not a copy */
+  rowFit(E, row);
+  if (E->engine == ENGINE_PIECES && E->hot != row) {
+    editorCommitHot(E);
+    E->hot = row;
+  }
+  rowDetach(row);
+}
+
+/* ENGINE_PIECES: move a row's text to the add buffer, making it a piece. */
+void rowCommit(editorConfig* E, row* row) {
+  if (row->flags & ROW_SHARED)
+    return;
+  char* chars = rowChars(row);
+  row->chars = (char*)pieceAppend(&E->pieces, chars, row->size);
+  rowFreeText(row, chars);
+  row->gap = row->size;
+  row->gaplen = 0;
+  row->flags |= ROW_SHARED;
+}
+
+/* Render row number at if needed, keeping at most RENDER_CACHE_ROWS rows
+ * rendered besides the ones on screen. */
+void rowMaterialize(editorConfig* E, row* row, int at) {
+  int cached = row->flags & ROW_RENDERED;
+  /* the window follows E->coloff, rebuild it every time */
+  if (row->flags & ROW_ROPE)
+    rowRenderWindow(E, row);
+  else if (!cached)
+    rowRender(E, row);
+  if (!cached)
+    renderCacheAdd(E, at);
 }
 
 void deleteRow(editorConfig* E, int at) {
   if (at < 0 || at >= E->numrows)
     return;
 
-  freerow(&E->data[at]);
-  memmove(&E->data[at], &E->data[at] + 1, sizeof(row) * (E->numrows - at - 1));
+  row* row = editorRow(E, at);
+  if (E->hot == row)
+    E->hot = NULL;
+  else
+    editorCommitHot(E);
+  freerow(row);
+  rowTreeDelete(&E->rows, at);
+  renderCacheShift(E, at, -1);
   E->numrows--;
   E->dirty++;
 }
 
 void rowAppendString(editorConfig* E, row* row, char* s, size_t len) {
-  row->chars = realloc(row->chars, row->size + len + 1);
-  memcpy(&row->chars[row->size], s, len);
-  row->size += len;
-  row->chars[row->size] = '\0';
+  rowInsertString(E, row, row->size, s, len);
   updateRow(E, row);
-  E->dirty++;
 }
 
+/* First line break in [s, end), end if none. */
+static const char* nextBreak(const char* s, const char* end) {
+  while (s < end && *s != '\r' && *s != '\n')
+    s++;
+  return s;
+}
+
+/* Past the line break at s, \r\n being one. */
+static const char* skipBreak(const char* s, const char* end) {
+  if (*s == '\r' && s + 1 < end && s[1] == '\n')
+    return s + 2;
+  return s + 1;
+}
+
+/* Insert text at the cursor as one edit, e.g. a paste. Lines end with \r,
+ * \n or \r\n. The cursor row is split once, the rows in between are built
+ * a batch at a time and only the two ends are rendered again. */
+void editorInsertText(editorConfig* E, const char* s, size_t len) {
+  const char* end = s + len;
+  if (E->cy == E->numrows)
+    insertRow(E, E->numrows, "", 0);
+  row* row = editorRow(E, E->cy);
+  if (E->cx > row->size)
+    E->cx = row->size;
+
+  const char* eol = nextBreak(s, end);
+  if (eol == end) {
+    rowInsertString(E, row, E->cx, s, len);
+    updateRow(E, row);
+    E->cx += len;
+    return;
+  }
+
+  /* the first line ends the head of the cursor row, the last one goes in
+   * front of its tail */
+  insertNewLine(E);
+  rowAppendString(E, editorRow(E, E->cy - 1), (char*)s, eol - s);
+
+  struct row batch[PASTE_BATCH];
+  int n = 0;
+  int at = E->cy;
+  const char* p = skipBreak(eol, end);
+  while ((eol = nextBreak(p, end)) != end) {
+    rowInit(E, &batch[n++], p, eol - p);
+    if (n == PASTE_BATCH) {
+      editorAddRows(E, at, batch, n);
+      at += n;
+      n = 0;
+    }
+    p = skipBreak(eol, end);
+  }
+  editorAddRows(E, at, batch, n);
+  at += n;
+
+  row = editorRow(E, at);
+  rowInsertString(E, row, 0, p, end - p);
+  updateRow(E, row);
+  E->cy = at;
+  E->cx = end - p;
+}
+
+/* Delete the character at byte at, with the marks drawn on it. */
 void rowdeleteChar(editorConfig* E, row* row, int at) {
   if (at < 0 || at >= row->size)
     return;
-  memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-  row->size--;
-  updateRow(E, row);
+  int len = rowNextChar(row, at) - at;
+  unsigned char c = rowByte(row, at);
+  rowTouch(E, row);
+  if (row->flags & ROW_ROPE) {
+    row->rope = ropeDelete(row->rope, at, len);
+  } else {
+    /* the gap swallows the character just before it */
+    rowGapMove(row, at + len);
+    row->gap -= len;
+    row->gaplen += len;
+  }
+  row->size -= len;
+  rowTreeResize(row, -len);
+  if (len == 1)
+    updateRowEdit(E, row, at, c, -1);
+  else
+    updateRow(E, row);
   E->dirty++;
 }
 
@@ -401,13 +1716,28 @@ void deleteChar(editorConfig* E) {
   if (E->cx == 0 && E->cy == 0)
     return;
 
-  row* row = &E->data[E->cy];
+  row* row = editorRow(E, E->cy);
   if (E->cx > 0) {
-    rowdeleteChar(E, row, E->cx - 1);
-    E->cx--;
+    E->cx = rowPrevChar(row, E->cx);
+    rowdeleteChar(E, row, E->cx);
   } else {
-    E->cx = E->data[E->cy - 1].size;
-    rowAppendString(E, &E->data[E->cy - 1], row->chars, row->size);
+    struct row* prev = editorRow(E, E->cy - 1);
+    E->cx = prev->size;
+    /* touch the previous row first, it may commit (and free) this one */
+    rowTouch(E, prev);
+    if (row->flags & ROW_ROPE) {
+      /* hand the rope over instead of flattening it */
+      if (!(prev->flags & ROW_ROPE))
+        rowToRope(prev);
+      prev->rope = ropeConcat(prev->rope, row->rope);
+      prev->size += row->size;
+      rowTreeResize(prev, row->size);
+      row->rope = NULL;
+      updateRow(E, prev);
+      E->dirty++;
+    } else {
+      rowAppendString(E, prev, rowChars(row), row->size);
+    }
     deleteRow(E, E->cy);
     E->cy--;
   }
@@ -426,99 +1756,166 @@ void replaceChar(editorConfig* E, int ch) {
 }
 
 char* rowsToString(editorConfig* E, int* buflen) {
-  int totlen = 0;
-  int j;
-  for (j = 0; j < E->numrows; j++) {
-    /* size + 1 is because we strip off \n
-    when read it in the buffer */
-    totlen += E->data[j].size + 1;
-  }
+  /* size + 1 per row is because we strip off \n when read it in the
+   * buffer, the row tree keeps the sum */
+  int totlen = rowTreeBytes(&E->rows);
   *buflen = totlen;
+  rowIter it;
+  row* row;
 
   char* buf = malloc(totlen);
   char* p = buf;
-  for (j = 0; j < E->numrows; j++) {
-    memcpy(p, E->data[j].chars, E->data[j].size);
-    p += E->data[j].size;
+  for (row = rowTreeSeek(&E->rows, 0, &it); row; row = rowTreeNext(&it)) {
+    if (row->flags & ROW_ROPE) {
+      ropeCopy(row->rope, 0, row->size, p);
+    } else {
+      char* text = ROW_TEXT(row);
+      memcpy(p, text, row->gap);
+      memcpy(p + row->gap, &text[row->gap + row->gaplen], row->size - row->gap);
+    }
+    p += row->size;
     *p = '\n';
     p++;
   }
   return buf;
 }
 
-int readInput(editorConfig* E) {
-  /* TODO: MacOS command key, in linux it's Ctrl*/
-  char c;
-  int rc;
-  while ((rc = read(STDIN_FILENO, &c, 1)) != 1) {
-    check(rc == -1 && errno != EAGAIN, "read from input fail");
+long monotonicMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+/* Read the pending SIGWINCH off fd, returns whether there was one. */
+static int resizeTake(int fd) {
+  struct signalfd_siginfo info[4];
+  int got = 0;
+  while (read(fd, info, sizeof(info)) > 0)
+    got = 1;
+  return got;
+}
+
+/* Follow a resize of the terminal. The rest of its burst is waited for and
+ * taken with it, so that only the final size is drawn. */
+static void editorResize(editorConfig* E) {
+  long until = monotonicMs() + RESIZE_SETTLE;
+  struct pollfd fd = {E->resizefd, POLLIN, 0};
+  while (resizeTake(E->resizefd)) {
+    long left = until - monotonicMs();
+    if (left <= 0)
+      break;
+    if (poll(&fd, 1, left < RESIZE_QUIET ? left : RESIZE_QUIET) <= 0)
+      break;
   }
+  updateEditor(E);
+}
 
-  if (c == '\x1b') {
-    char seq[3];
-    if (read(STDIN_FILENO, &seq[0], 1) != 1) {
-      return '\x1b';
+/* Sleep until there is input to read, or ms milliseconds pass (never if
+ * ms < 0), returns whether input came. What's buffered already doesn't
+ * count, this is called when it isn't a whole key. Meanwhile the terminal
+ * is followed when resized, rows published by the loader are shown and the
+ * status message is taken down when it expires; with none of it going on,
+ * nothing wakes the editor up. */
+int editorWait(editorConfig* E, int ms) {
+  long deadline = ms < 0 ? -1 : monotonicMs() + ms;
+  while (1) {
+    struct pollfd fds[3] = {
+        {E->input.fd, POLLIN, 0}, {-1, POLLIN, 0}, {E->resizefd, POLLIN, 0}};
+    if (E->loading)
+      fds[1].fd = loaderFd(&E->load);
+    int timeout = -1;
+    if (E->statusmsg[0]) {
+      time_t left = E->statusmsg_time + STATUS_TIMEOUT - time(NULL);
+      timeout = left > 0 ? left * 1000 : 0;
     }
-    if (read(STDIN_FILENO, &seq[1], 1) != 1) {
-      return '\x1b';
+    if (deadline >= 0) {
+      long left = deadline - monotonicMs();
+      if (left < 0)
+        left = 0;
+      if (timeout < 0 || left < timeout)
+        timeout = left;
     }
-    if (seq[0] == '[') {
-      if (seq[1] >= '0' && seq[1] <= '9') {
-        if (read(STDIN_FILENO, &seq[2], 1) != 1) {
-          return '\x1b';
-        }
+    int n = poll(fds, 3, timeout);
+    check(n == -1 && errno != EINTR, "poll on input fail");
+
+    int changed = 0;
+    if (n > 0 && fds[2].revents) {
+      /* before the keys that came with it, they're for the new size */
+      editorResize(E);
+      changed = 1;
+    }
+    if (n > 0 && fds[1].revents)
+      changed |= editorLoadPoll(E);
+    if (E->statusmsg[0] && time(NULL) - E->statusmsg_time >= STATUS_TIMEOUT) {
+      E->statusmsg[0] = '\0';
+      changed = 1;
+    }
+    if (changed)
+      renderScreen(E);
+    if (n > 0 && fds[0].revents)
+      return 1;
+    if (deadline >= 0 && monotonicMs() >= deadline)
+      return 0;
+  }
+}
 
-        if (seq[2] == '~') {
-          switch (seq[1]) {
-            case '1':
-              return HOME_KEY;
-            case '3':
-              return DEL_KEY;
-            case '4':
-              return END_KEY;
-            case '5':
-              return PAGE_UP;
-            case '6':
-              return PAGE_DOWN;
-            case '7':
-              return HOME_KEY;
-            case '8':
-              return END_KEY;
-          }
-        }
-      } else {
-        switch (seq[1]) {
-          case 'A':
-            return ARROW_UP;
-          case 'B':
-            return ARROW_DOWN;
-          case 'C':
-            return ARROW_RIGHT;
-          case 'D':
-            return ARROW_LEFT;
-          case 'H':
-            return HOME_KEY;
-          case 'F':
-            return END_KEY;
-        }
-      }
-    } else if (seq[0] == 'O') {
-      switch (seq[1]) {
-        case 'H':
-          return HOME_KEY;
-        case 'F':
-          return END_KEY;
-      }
+/* Read what's there into the input ring, after editorWait said so. */
+static void editorFill(editorConfig* E) {
+  int rc = inputFill(&E->input);
+  check(rc == -1 && errno != EAGAIN && errno != EINTR,
+        "read from input fail");
+}
+
+int readInput(editorConfig* E) {
+  /* TODO: MacOS command key, in linux it's Ctrl*/
+  while (1) {
+    int key = inputKey(&E->input, 0);
+    if (key == MODE_REPORT) {
+      /* 1 set or 2 reset means the mode is known, 0 or 4 not */
+      int value = E->input.params[1];
+      if (E->input.params[0] == 2026)
+        screenSynchronized(&E->screen, value == 1 || value == 2);
+      continue;
+    }
+    if (key >= 0)
+      return key;
+    if (key == INPUT_PARTIAL) {
+      /* an ESC, unless the rest of a sequence follows shortly */
+      if (!editorWait(E, ESC_TIMEOUT))
+        return inputKey(&E->input, 1);
     } else {
-      return '\x1b';
+      editorWait(E, -1);
     }
+    editorFill(E);
   }
-  return c;
+}
+
+/* Take in a bracketed paste up to PASTE_END as one insertion, instead of
+ * key by key (no jj/jk, no rendering per line). */
+void editorPaste(editorConfig* E) {
+  buffer text = BUFFER_INIT;
+  while (!inputTake(&E->input, PASTE_END, &text)) {
+    if (!editorWait(E, PASTE_TIMEOUT))
+      break;
+    editorFill(E);
+  }
+
+  if (E->mode == NORMAL_MODE)
+    editorCheckpoint(E);
+  editorInsertText(E, text.start, text.size);
+  bufferFree(&text);
 }
 
 void processEvent(editorConfig* E) {
   int number = 1;
   int c = readInput(E);
+  if (c == PASTE_START) {
+    editorPaste(E);
+    return;
+  }
+  /* a character being typed is cut short by anything but its next byte */
+  if (c < 0x80 || c > 0xbf)
+    E->typedlen = 0;
 
   char prevKeyStroke = E->keyStroke;
   E->keyStroke = (char)c;
@@ -528,8 +1925,12 @@ void processEvent(editorConfig* E) {
   if (E->mode == NORMAL_MODE) {
     switch (c) {
       case 'i':
+        editorCheckpoint(E);
         E->mode = INSERT_MODE;
         break;
+      case 'u':
+        editorUndo(E);
+        break;
       case 'c':
       case 'd': {
         int next = readInput(E);
@@ -561,8 +1962,15 @@ void processEvent(editorConfig* E) {
         processNormalCommand(E, c);
         break;
       case CTRL_KEY('f'):
+      case PAGE_DOWN:
+        movePage(E, PAGE_DOWN);
+        break;
+      case CTRL_KEY('b'):
+      case PAGE_UP:
+        movePage(E, PAGE_UP);
         break;
       case 'x':
+        editorCheckpoint(E);
         moveCursor(E, ARROW_RIGHT);
         deleteChar(E);
         break;
@@ -583,16 +1991,19 @@ void processEvent(editorConfig* E) {
         if (prevKeyStroke == 'g' &&
             (E->keystroke_time - prevKeystrokeTime) < KEY_TIMEOUT) {
           E->cy = 0;
-          if (E->cx > E->data[E->cy].size - 1) {
-            E->cx = E->data[E->cy].size - 1;
+          if (E->numrows > 0 && E->cx > editorRow(E, E->cy)->size - 1) {
+            E->cx = editorRow(E, E->cy)->size - 1;
           }
         }
         break;
       /* to the buttom */
       case 'G':
+        editorLoadWait(E, INT_MAX);
+        if (E->numrows == 0)
+          break;
         E->cy = E->numrows - 1;
-        if (E->cx > E->data[E->cy].size - 1) {
-          E->cx = E->data[E->cy].size - 1;
+        if (E->cx > editorRow(E, E->cy)->size - 1) {
+          E->cx = editorRow(E, E->cy)->size - 1;
         }
         break;
       case 'z':
@@ -621,7 +2032,7 @@ void processEvent(editorConfig* E) {
       case '$':
       case END_KEY:
         if (E->cy < E->numrows) {
-          E->cx = E->data[E->cy].size - 1;
+          E->cx = editorRow(E, E->cy)->size - 1;
         }
         break;
       case ARROW_UP:
@@ -671,6 +2082,10 @@ void processEvent(editorConfig* E) {
       case ARROW_RIGHT:
         moveCursor(E, c);
         break;
+      case PAGE_UP:
+      case PAGE_DOWN:
+        movePage(E, c);
+        break;
       case BACKSPACE:
       case CTRL_KEY('h'):
       case DEL_KEY:
@@ -717,6 +2132,9 @@ void processNormalCommand(editorConfig* E, char c) {
     int c = readInput(E);
     if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) {
       if (buflen != 0) {
+        /* a whole character, its continuation bytes first */
+        while (buflen > 1 && (buf[buflen - 1] & 0xc0) == 0x80)
+          buflen--;
         buf[--buflen] = '\0';
         if (buflen == 0) {
           setStatusMessage(E, "%s", "");
@@ -745,13 +2163,14 @@ void processNormalCommand(editorConfig* E, char c) {
           return;
         } else if (strcmp(buf, ":q!") == 0) {
           free(buf);
+          screenSync(&E->screen);
           write(STDOUT_FILENO, "\x1b[2J", 4);
           write(STDOUT_FILENO, "\x1b[H", 3);
           exit(0);
         } else if (buf[0] == '/') {
           setStatusMessage(E, "");
           int qlen = strlen(buf) - 1;
-          char* query = malloc(qlen);
+          char* query = malloc(qlen + 1);
           memcpy(query, &buf[1], qlen);
           query[qlen] = '\0';
           editorFind(E, query);
@@ -759,6 +2178,24 @@ void processNormalCommand(editorConfig* E, char c) {
           free(buf);
           free(query);
           return;
+        } else if (strcmp(buf, ":mem") == 0) {
+          editorMemReport(E);
+          free(buf);
+          return;
+        } else if (strncmp(buf, ":set tabstop=", 13) == 0 ||
+                   strncmp(buf, ":set ts=", 8) == 0) {
+          editorSetTabWidth(E, atoi(strchr(buf, '=') + 1));
+          free(buf);
+          return;
+        } else if (strncmp(buf, ":goto ", 6) == 0) {
+          /* like vim, byte counts start at 1 */
+          editorGotoByte(E, atol(&buf[6]) - 1);
+          free(buf);
+          return;
+        } else if (isdigit(buf[1])) {
+          editorGotoLine(E, atoi(&buf[1]));
+          free(buf);
+          return;
         } else {
           /* TODO: warning message should be red*/
           setStatusMessage(E, "Unknown command");
@@ -766,7 +2203,7 @@ void processNormalCommand(editorConfig* E, char c) {
           return;
         }
       }
-    } else if (!iscntrl(c) && c < 128) {
+    } else if (!iscntrl(c) && c < 256) {
       if (buflen == bufsize - 1) {
         /* TODO: amortized cost */
         bufsize *= 2;
@@ -791,8 +2228,11 @@ char* promptInfo(editorConfig* E, char* info) {
 
     int c = readInput(E);
     if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE) {
-      if (buflen != 0)
+      if (buflen != 0) {
+        while (buflen > 1 && (buf[buflen - 1] & 0xc0) == 0x80)
+          buflen--;
         buf[--buflen] = '\0';
+      }
     } else if (c == '\x1b') {
       setStatusMessage(E, "");
       free(buf);
@@ -802,7 +2242,7 @@ char* promptInfo(editorConfig* E, char* info) {
         setStatusMessage(E, "");
         return buf;
       }
-    } else if (!iscntrl(c) && c < 128) {
+    } else if (!iscntrl(c) && c < 256) {
       if (buflen == bufsize - 1) {
         bufsize *= 2;
         buf = realloc(buf, bufsize);
@@ -813,22 +2253,33 @@ char* promptInfo(editorConfig* E, char* info) {
   }
 }
 
+/* Byte of row E->cy at the column the cursor was at on row from, so that
+ * moving up and down keeps the column instead of the byte. */
+static int cursorColumnTo(editorConfig* E, row* from) {
+  if (from == NULL)
+    return E->cx;
+  int rx = rowCxToRx(from, E->cx);
+  return rowRxToCx(editorRow(E, E->cy), rx);
+}
+
 void moveCursor(editorConfig* E, int key) {
-  row* row = (E->cy >= E->numrows) ? NULL : &E->data[E->cy];
+  /* moving past the loaded rows waits for the next ones */
+  editorLoadWait(E, E->cy + 2);
+  row* row = editorRow(E, E->cy);
   switch (key) {
     case ARROW_LEFT:
       if (E->cx != 0) {
-        E->cx--;
+        E->cx = rowPrevChar(row, E->cx);
       } else if (E->cx == 0) {
         if (E->cy > 0) {
           E->cy--;
-          E->cx = E->data[E->cy].size - 1;
+          E->cx = editorRow(E, E->cy)->size - 1;
         }
       }
       break;
     case ARROW_RIGHT:
       if (row && E->cx < row->size) {
-        E->cx++;
+        E->cx = rowNextChar(row, E->cx);
         if (E->cx == row->size) {
           if (E->cy < E->numrows - 1) {
             E->cy++;
@@ -845,17 +2296,19 @@ void moveCursor(editorConfig* E, int key) {
     case ARROW_UP:
       if (E->cy != 0) {
         E->cy--;
+        E->cx = cursorColumnTo(E, row);
       }
       break;
     case ARROW_DOWN:
       /* E->numrows is 1-based */
       if (E->cy < E->numrows - 1) {
         E->cy++;
+        E->cx = cursorColumnTo(E, row);
       }
       break;
   }
 
-  row = (E->cy >= E->numrows) ? NULL : &E->data[E->cy];
+  row = editorRow(E, E->cy);
   int rowlen = row ? row->size - 1 : 0;
   if (E->cx > rowlen) {
     E->cx = rowlen;
@@ -863,42 +2316,121 @@ void moveCursor(editorConfig* E, int key) {
   if (E->cx < 0) {
     E->cx = 0;
   }
+  if (row)
+    E->cx = rowCharStart(row, E->cx);
 }
 
-void bufferAppend(buffer* buf, const char* s, int len) {
-  char* new = realloc(buf->start, buf->size + len);
-  check((new == NULL), "Fail to append buffer");
+/* Scroll a screen down (PAGE_DOWN) or up, keeping PAGE_OVERLAP rows of the
+ * old one. The cursor only moves if it would leave the screen. */
+void movePage(editorConfig* E, int key) {
+  int step = E->screenrows - PAGE_OVERLAP;
+  if (step < 1)
+    step = 1;
+  if (key == PAGE_DOWN) {
+    editorLoadWait(E, E->rowoff + step + E->screenrows);
+    E->rowoff += step;
+    if (E->rowoff > E->numrows - 1)
+      E->rowoff = E->numrows > 0 ? E->numrows - 1 : 0;
+    if (E->cy < E->rowoff)
+      E->cy = E->rowoff;
+  } else {
+    E->rowoff -= step;
+    if (E->rowoff < 0)
+      E->rowoff = 0;
+    if (E->cy > E->rowoff + E->screenrows - 1)
+      E->cy = E->rowoff + E->screenrows - 1;
+  }
+
+  row* row = editorRow(E, E->cy);
+  int rowlen = row ? row->size - 1 : 0;
+  if (E->cx > rowlen)
+    E->cx = rowlen;
+  if (E->cx < 0)
+    E->cx = 0;
+}
+
+/* Make room for len more bytes, doubling so that growing is amortized. */
+void bufferReserve(buffer* buf, int len) {
+  if (buf->size + len <= buf->cap)
+    return;
+  int cap = buf->cap * 2 > buf->size + len ? buf->cap * 2 : buf->size + len;
+  cap = poolSize(cap);
+  buf->start = poolRealloc(buf->start, buf->cap, cap);
+  buf->cap = cap;
+}
 
-  memmove(&new[buf->size], s, len);
-  buf->start = new;
+void bufferAppend(buffer* buf, const char* s, int len) {
+  bufferReserve(buf, len);
+  memmove(&buf->start[buf->size], s, len);
   buf->size += len;
 }
 
 void bufferFree(buffer* buf) {
-  free(buf->start);
+  poolFree(buf->start, buf->cap);
 }
 
 int rowCxToRx(row* row, int cx) {
+  if (row->flags & ROW_ROPE)
+    return ropeColumn(row->rope, cx);
+  if (row->flags & ROW_ALIAS)
+    return cx;
+  if (row->flags & ROW_RENDERED) {
+    /* column for byte since the last stop at or before cx */
+    charStop* s = rowStopAt(row, offsetof(charStop, cx), cx);
+    if (s == NULL)
+      return cx;
+    if (cx < s->cx + s->len)
+      return s->rx;
+    return s->rx + s->width + cx - s->cx - s->len;
+  }
   int rx = 0;
-  int j;
-  for (j = 0; j < cx; j++) {
-    if (row->chars[j] == '\t')
-      rx += (TAB_WIDTH - 1) - (rx % TAB_WIDTH);
-    rx++;
+  int j = 0;
+  while (j < cx) {
+    if (ROW_CHAR(row, j) == '\t') {
+      rx += tabColumns(rx);
+      j++;
+      continue;
+    }
+    int cp;
+    int len = rowCharAt(row, j, &cp);
+    if (j + len > cx)
+      break;
+    rx += utf8Width(cp);
+    j += len;
   }
   return rx;
 }
 
 int rowRxToCx(row* row, int rx) {
+  if (row->flags & ROW_ROPE)
+    return ropeByteAt(row->rope, rx);
+  if (row->flags & ROW_RENDERED) {
+    /* byte for column after the last stop at or before rx, or that stop
+     * if rx is within it */
+    charStop* s = rowStopAt(row, offsetof(charStop, rx), rx);
+    int cx = rx;
+    if (s != NULL && rx < s->rx + s->width)
+      cx = s->cx;
+    else if (s != NULL)
+      cx = s->cx + s->len + rx - s->rx - s->width;
+    if (cx < 0)
+      cx = 0;
+    return cx < row->size ? cx : row->size;
+  }
   int cur_rx = 0;
-  int cx;
-  for (cx = 0; cx < row->size; cx++) {
-    if (row->chars[cx] == '\t') {
-      cur_rx += (TAB_WIDTH - 1) - (cur_rx % TAB_WIDTH);
+  int cx = 0;
+  while (cx < row->size) {
+    int len = 1;
+    if (ROW_CHAR(row, cx) == '\t') {
+      cur_rx += tabColumns(cur_rx);
+    } else {
+      int cp;
+      len = rowCharAt(row, cx, &cp);
+      cur_rx += utf8Width(cp);
     }
-    cur_rx++;
     if (cur_rx > rx)
       return cx;
+    cx += len;
   }
   return cx;
 }
@@ -906,7 +2438,10 @@ int rowRxToCx(row* row, int rx) {
 void scrollScreen(editorConfig* E) {
   E->rx = 1;
   if (E->cy < E->numrows) {
-    E->rx = rowCxToRx(&E->data[E->cy], E->cx);
+    row* row = editorRow(E, E->cy);
+    /* e.g. from a move to a row where the same byte is inside a character */
+    E->cx = rowCharStart(row, E->cx);
+    E->rx = rowCxToRx(row, E->cx);
   }
   E->ry = E->cy;
 
@@ -924,18 +2459,78 @@ void scrollScreen(editorConfig* E) {
   }
 }
 
-void renderRows(editorConfig* E, buffer* buf) {
+/* Line number gutter of row number at: the number right aligned in
+ * LINE_NUMBER_DATA columns. Returns its length. */
+static int formatGutter(char* out, int at) {
+  char digits[12];
+  int n = 0;
+  unsigned int number = at + 1;
+  do {
+    digits[n++] = '0' + number % 10;
+    number /= 10;
+  } while (number);
+
+  int len = 0;
+  for (int pad = LINE_NUMBER_DATA - n; pad > 0; pad--)
+    out[len++] = ' ';
+  while (n)
+    out[len++] = digits[--n];
+  return len;
+}
+
+/* Bring the gutters of the rows on screen up to date. They only depend on
+ * the row numbers, so scrolling moves the cached ones and formats just the
+ * rows that came into view. Each is GUTTER_SIZE bytes, its length first. */
+static void gutterSync(editorConfig* E) {
+  int rows = E->screenrows;
+  if (E->gutterrows != rows) {
+    E->gutter = realloc(E->gutter, (size_t)rows * GUTTER_SIZE);
+    check(E->gutter == NULL, "Fail to allocate gutter");
+    E->gutterrows = rows;
+    E->guttertop = -1;
+  }
+
+  /* screen rows [from, to) are still valid once moved */
+  int shift = E->rowoff - E->guttertop;
+  int from = 0;
+  int to = 0;
+  if (E->guttertop != -1 && shift > -rows && shift < rows) {
+    if (shift > 0) {
+      memmove(E->gutter, &E->gutter[shift * GUTTER_SIZE],
+              (size_t)(rows - shift) * GUTTER_SIZE);
+      to = rows - shift;
+    } else {
+      memmove(&E->gutter[-shift * GUTTER_SIZE], E->gutter,
+              (size_t)(rows + shift) * GUTTER_SIZE);
+      from = -shift;
+      to = rows;
+    }
+  }
+  for (int y = 0; y < rows; y++) {
+    if (y >= from && y < to)
+      continue;
+    char* g = &E->gutter[y * GUTTER_SIZE];
+    g[0] = formatGutter(&g[1], E->rowoff + y);
+  }
+  E->guttertop = E->rowoff;
+}
+
+void renderRows(editorConfig* E) {
   /* TODO: a extra line will be displayed at the end
   of the file, fix it. e.g: 9/8 in the status bar.
   should be 8/8. Related: cx, numrows */
+  screen* s = &E->screen;
   int y;
+  rowIter it;
+  row* row = rowTreeSeek(&E->rows, E->rowoff, &it);
+  gutterSync(E);
   /* TODO: put more information into welcoming message, e.g.
    * help, how to quit..., see what vim & nvim does!! especially
    * when window size change or too small*/
-  for (y = 0; y < E->screenrows; y++) {
+  for (y = 0; y < E->screenrows; y++, row = rowTreeNext(&it)) {
     int filerow = y + E->rowoff;
 
-    if (y >= E->numrows) {
+    if (row == NULL) {
       /* no file displayed */
       if (E->numrows == 0 && y == E->screenrows / 3) {
         char welcome[80];
@@ -944,98 +2539,101 @@ void renderRows(editorConfig* E, buffer* buf) {
         if (welcomeLen > E->screenrows)
           welcomeLen = E->screenrows;
         int padding = (E->screencols - welcomeLen) / 2;
-
-        while (padding--) {
-          bufferAppend(buf, " ", 1);
-        }
-        bufferAppend(buf, welcome, welcomeLen);
+        if (padding < 0)
+          padding = 0;
+        screenPut(s, y, padding, welcome, welcomeLen, 0);
       }
+      continue;
+    }
 
-    } else {
-      /* line number section */
-      bufferAppend(buf, "\x1b[36m", 5);
-      char lineNumber[10];
-      int numberLen =
-          snprintf(lineNumber, sizeof(lineNumber), "%d", filerow + 1);
-      int lineLen = LINE_NUMBER_DATA;
-      while (lineLen-- > numberLen) {
-        bufferAppend(buf, " ", 1);
-      }
-      bufferAppend(buf, lineNumber, numberLen);
-      bufferAppend(buf, "\x1b[m", 3);
-      bufferAppend(buf, " ", LINE_NUMBER_PADDING);
-
-      /* Data section */
-      int rowDataLen = E->data[filerow].rsize - E->coloff;
-      if (rowDataLen < 0)
-        rowDataLen = 0;
-      if (rowDataLen > E->screencols - LINE_NUMBER_WIDTH)
-        rowDataLen = E->screencols - LINE_NUMBER_WIDTH;
-
-      char* data = &E->data[filerow].render[E->coloff];
-      unsigned char* hl = &E->data[filerow].hl[E->coloff];
-      int current_color = -1;
-      for (int j = 0; j < rowDataLen; j++) {
-        if (hl[j] == HL_NORMAL) {
-          if (current_color != -1) {
-            bufferAppend(buf, "\x1b[39m", 5);
-            current_color = -1;
-          }
-
-          bufferAppend(buf, &data[j], 1);
-        } else {
-          int color = syntaxToColor(hl[j]);
-          if (color != current_color) {
-            current_color = color;
-            char tmp[16];
-            int clen = snprintf(tmp, sizeof(tmp), "\x1b[%dm", color);
-            bufferAppend(buf, tmp, clen);
-          }
-
-          bufferAppend(buf, &data[j], 1);
-        }
+    /* line number section */
+    char* gutter = &E->gutter[y * GUTTER_SIZE];
+    int x = screenPut(s, y, 0, &gutter[1], gutter[0], 36) + LINE_NUMBER_PADDING;
+
+    /* Data section */
+    rowMaterialize(E, row, filerow);
+    int pad;
+    int j = rowRenderOffset(row, E->coloff, &pad);
+    x += pad;
+    char* seg[2];
+    int seglen[2];
+    rowRenderSegments(row, seg, seglen);
+    /* one put per run of equally highlighted characters, up to the bytes
+     * the rest of the screen could take; an alias row's gap ends a run,
+     * it's plain ASCII and never cuts a character */
+    int base = 0;
+    for (int k = 0; k < 2 && x < E->screencols; k++) {
+      char* data = seg[k];
+      unsigned char* hl = &row->hl[base];
+      int n = seglen[k];
+      int i = j - base;
+      while (i < n && x < E->screencols) {
+        int most = i + (E->screencols - x) * UTF8_MAX;
+        int end = i + 1;
+        while (end < n && (end < most || (data[end] & 0xc0) == 0x80) &&
+               hl[end] == hl[i])
+          end++;
+        int attr = hl[i] == HL_NORMAL ? 0 : syntaxToColor(hl[i]);
+        x = screenPut(s, y, x, &data[i], end - i, attr);
+        i = end;
       }
-      bufferAppend(buf, "\x1b[39m", 5);
+      base += n;
+      if (j < base)
+        j = base;
     }
-
-    bufferAppend(buf, "\x1b[K", 3); /* Erases from the current cursor position
-                              to the end of the current line */
-    bufferAppend(buf, "\r\n", 2);
   }
 }
 
-void renderStatusBar(editorConfig* E, buffer* buf) {
-  bufferAppend(buf, "\x1b[7m", 4);
+static void formatCount(char* buf, size_t size, long n) {
+  if (n >= 1000000)
+    snprintf(buf, size, "%.1fM", n / 1e6);
+  else if (n >= 1000)
+    snprintf(buf, size, "%.1fK", n / 1e3);
+  else
+    snprintf(buf, size, "%ld", n);
+}
 
+void renderStatusBar(editorConfig* E) {
   char status[80], rstatus[80];
-  int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-                     E->filename ? E->filename : "[No Name]", E->numrows,
-                     E->dirty ? "(modified)" : "");
-  int rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d", E->cy + 1, E->numrows);
+  int len;
+  if (E->loading) {
+    /* total is extrapolated from the bytes loaded so far */
+    char loaded[16], total[16];
+    long estimate = E->loadoff ? (double)E->numrows * E->mapsize / E->loadoff
+                               : E->numrows;
+    formatCount(loaded, sizeof(loaded), E->numrows);
+    formatCount(total, sizeof(total), estimate);
+    len = snprintf(status, sizeof(status), "%.20s - loaded %s/~%s lines %s",
+                   E->filename, loaded, total, E->dirty ? "(modified)" : "");
+  } else {
+    len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
+                   E->filename ? E->filename : "[No Name]", E->numrows,
+                   E->dirty ? "(modified)" : "");
+  }
+  int rlen = snprintf(rstatus, sizeof(rstatus), "%d/%d %d%%", E->cy + 1,
+                      E->numrows, editorPercent(E));
   if (len > E->screencols)
     len = E->screencols;
-  bufferAppend(buf, status, len);
+  int y = E->screenrows;
+  screenPut(&E->screen, y, 0, status, len, CELL_REVERSE);
 
   while (len < E->screencols) {
     if (E->screencols - len == rlen) {
-      bufferAppend(buf, rstatus, rlen);
+      screenPut(&E->screen, y, len, rstatus, rlen, CELL_REVERSE);
       break;
     } else {
-      bufferAppend(buf, " ", 1);
+      screenPut(&E->screen, y, len, " ", 1, CELL_REVERSE);
       len++;
     }
   }
-  bufferAppend(buf, "\x1b[m", 3);
-  bufferAppend(buf, "\r\n", 2);
 }
 
-void renderMessageBar(editorConfig* E, buffer* buf) {
-  bufferAppend(buf, "\x1b[K", 3);
+void renderMessageBar(editorConfig* E) {
   int msglen = strlen(E->statusmsg);
   if (msglen > E->screencols)
     msglen = E->screencols;
-  if (msglen && time(NULL) - E->statusmsg_time < 5)
-    bufferAppend(buf, E->statusmsg, msglen);
+  if (msglen && time(NULL) - E->statusmsg_time < STATUS_TIMEOUT)
+    screenPut(&E->screen, E->screenrows + 1, 0, E->statusmsg, msglen, 0);
 }
 
 void renderCursor(editorConfig* E) {
@@ -1047,53 +2645,58 @@ void renderScreen(editorConfig* E) {
   scrollScreen(E);
   renderCursor(E);
 
-  buffer buf = BUFFER_INIT;
-  /* set cursor invisible to avoid flicker effect */
-  bufferAppend(&buf, "\x1b[?25l", 6);
-
-  /* Set cursor back to home. Do NOT comment out this line, will cause the whole
-   * program to break :( */
-  bufferAppend(&buf, "\x1b[H", 3);
-
-  renderRows(E, &buf);
-  renderStatusBar(E, &buf);
-  renderMessageBar(E, &buf);
+  /* draw the frame, then send only what differs from the last one */
+  screen* s = &E->screen;
+  screenResize(s, E->screenrows + 2, E->screencols);
+  /* rows still on screen after scrolling are moved by the terminal */
+  if (E->frameoff != -1)
+    screenScroll(s, 0, E->screenrows, E->rowoff - E->frameoff);
+  E->frameoff = E->rowoff;
+  screenClear(s);
+  renderRows(E);
+  renderStatusBar(E);
+  renderMessageBar(E);
 
   /* render cursor */
-  char tmp[32];
-  snprintf(tmp, sizeof(tmp), "\x1b[%d;%dH", E->ty, E->tx);
-  bufferAppend(&buf, tmp, strlen(tmp));
+  char tmp[FRAME_CURSOR_SIZE];
+  int len = snprintf(tmp, sizeof(tmp), "\x1b[%d;%dH", E->ty, E->tx);
 
   /* set cursor to the corresponding shape
   Block -> Normal mode
   Line -> Insert mode */
   if (E->mode == INSERT_MODE) {
-    bufferAppend(&buf, "\033[5 q", 5);
+    memcpy(&tmp[len], "\033[5 q", 5);
   } else {
-    bufferAppend(&buf, "\033[0 q", 5);
+    memcpy(&tmp[len], "\033[0 q", 5);
   }
+  len += 5;
   /* set cursor visible */
-  bufferAppend(&buf, "\x1b[?25h", 6);
+  memcpy(&tmp[len], "\x1b[?25h", 6);
+  len += 6;
+  screenCursor(s, tmp, len);
 
-  write(STDOUT_FILENO, buf.start, buf.size);
-  bufferFree(&buf);
+  /* the writer thread sends it, see screen.h */
+  screenSubmit(s);
 }
 
 int is_separator(int c) {
   return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
 }
 
+/* Highlight of a render byte, which doesn't depend on the others. */
+static unsigned char syntaxOf(unsigned char c) {
+  return isdigit(c) ? HL_NUMBER : HL_NORMAL;
+}
+
 void updateSyntax(row* row) {
-  row->hl = realloc(row->hl, row->rsize);
-  memset(row->hl, HL_NORMAL, row->rsize);
-
-  int i;
-  while (i < row->rsize) {
-    char c = row->render[i];
-    if (isdigit(c)) {
-      row->hl[i] = HL_NUMBER;
-    }
-    i++;
+  char* seg[2];
+  int seglen[2];
+  rowRenderSegments(row, seg, seglen);
+
+  int i = 0;
+  for (int k = 0; k < 2; k++) {
+    for (int j = 0; j < seglen[k]; j++)
+      row->hl[i++] = syntaxOf(seg[k][j]);
   }
 }
 
@@ -4,30 +4,139 @@
 #include <termios.h>  // orig_termios
 #include <time.h>
 
+#include "input.h"
+#include "loader.h"
+#include "piecetable.h"
+#include "pool.h"
+#include "rope.h"
+#include "rowtree.h"
+#include "screen.h"
+#include "utf8.h"
+
 /* TODO: VIM-like normal mode jumping
 e.g. w for word jump */
+/* columns between tab stops until :set tabstop changes it, see tabWidth */
 #define TAB_WIDTH 4
+#define TAB_WIDTH_MAX 32
 #define CTRL_KEY(k) ((k)&0x1f)
 #define KEY_TIMEOUT 0.5
+/* ms an ESC waits for the rest of a sequence before it's taken as a key */
+#define ESC_TIMEOUT 100
+/* seconds a status message stays up */
+#define STATUS_TIMEOUT 5
+/* ends a bracketed paste, which starts with \x1b[200~ (PASTE_START) */
+#define PASTE_END "\x1b[201~"
+/* a paste whose end doesn't come for this many ms is taken as over */
+#define PASTE_TIMEOUT 1000
+/* rows built at a time when pasting */
+#define PASTE_BATCH 256
+/* a resize is drawn once no other comes for RESIZE_QUIET ms, or after
+ * RESIZE_SETTLE ms of them, e.g. while the window's edge is dragged */
+#define RESIZE_QUIET 20
+#define RESIZE_SETTLE 100
+/* rows of the old screen still shown after a page up/down, like vim */
+#define PAGE_OVERLAP 2
 #define MIN_VERSION "0.0.1"
 /* width & padding for display line number at the left of the screen */
 #define LINE_NUMBER_DATA 3
 #define LINE_NUMBER_PADDING 1
 #define LINE_NUMBER_WIDTH (LINE_NUMBER_DATA + LINE_NUMBER_PADDING)
+/* bytes kept per cached line number */
+#define GUTTER_SIZE 16
 #define BUFFER_INIT \
-  { NULL, 0 }
+  { NULL, 0, 0 }
+/* iovecs per writev when saving */
+#define WRITE_IOV_BATCH (3 * 340)
+/* smallest gap opened in a row's text once it needs to grow */
+#define ROW_GAP_MIN 16
+/* a render is laid out with room to grow to the next multiple of this, or
+ * of an eighth of it when it's longer, so that an edit patches it in place */
+#define RENDER_SLACK 16
+/* bytes of text kept inside the row itself instead of on the heap, sized
+ * so that a row stays 56 bytes */
+#define ROW_EMBED_SIZE 24
+/* storage of a row's gap buffer */
+#define ROW_TEXT(r) ((r)->flags & ROW_EMBED ? (r)->embed : (r)->chars)
+/* j-th character of a row's gap buffer */
+#define ROW_CHAR(r, j) \
+  ((j) < (r)->gap ? ROW_TEXT(r)[(j)] : ROW_TEXT(r)[(j) + (r)->gaplen])
+/* files at least this large are mmap'ed instead of read line by line */
+#ifndef MMAP_OPEN_THRESHOLD
+#define MMAP_OPEN_THRESHOLD (1 << 20)
+#endif
+/* rows kept rendered besides the ones on screen */
+#ifndef RENDER_CACHE_ROWS
+#define RENDER_CACHE_ROWS 1024
+#endif
+/* most frames drawn per second while input keeps coming */
+#ifndef MAX_FPS
+#define MAX_FPS 60
+#endif
+/* ENGINE_ROWS rows at least this long are kept as ropes */
+#ifndef ROPE_ROW_MIN
+#define ROPE_ROW_MIN (1 << 18)
+#endif
 
 /* Data Buffer */
 typedef struct row {
+  /* Gap buffer: the text is chars[0, gap) followed by
+   * chars[gap + gaplen, size + gaplen), edits happen at the gap. */
+  union {
+    char* chars;
+    char embed[ROW_EMBED_SIZE]; /* ROW_EMBED: the gap buffer itself */
+    struct {
+      rope* rope; /* ROW_ROPE */
+      int roff;   /* column of render[0], only a window is rendered */
+    };
+  };
+  /* syntax highlight of each of the rsize bytes of the render, then the
+   * render unless ROW_ALIAS, both with some room, see rowRenderSegments */
+  unsigned char* hl;
   int size;
-  char* chars;
+  int gap;
+  int gaplen;
   int rsize;
-  char* render;
-  unsigned char* hl; /* syntax highlight */
+  int flags; /* ROW_SHARED, ... */
 } row;
 
+/* A character of a rendered row that doesn't take one byte of the text,
+ * one of the render and one column, i.e. a tab or a non-ASCII one: where it
+ * starts in each and how much of each it takes. Between two of them it's
+ * byte for byte and column for column. */
+typedef struct charStop {
+  int cx;
+  int rb;
+  int rx;
+  unsigned char len;   /* bytes of text */
+  unsigned char rlen;  /* bytes of render */
+  unsigned char width; /* columns */
+} charStop;
+
+/* row flags */
+enum rowFlag {
+  /* chars points into read-only text shared with others (the file mapping
+   * or the piece table add buffer), it's not owned and there is no gap */
+  ROW_SHARED = 1,
+  /* the text is a rope instead of a gap buffer, see rope.h */
+  ROW_ROPE = 2,
+  /* the gap buffer is stored in the row itself, for short ENGINE_ROWS rows */
+  ROW_EMBED = 4,
+  /* hl and the render are up to date, see rowMaterialize */
+  ROW_RENDERED = 8,
+  /* the row is ASCII without tabs, its render is its text and isn't stored */
+  ROW_ALIAS = 16,
+};
+
+/* buffer for STDOUT */
+typedef struct buffer {
+  char* start;
+  int size;
+  int cap;
+} buffer;
+
 typedef struct editorConfig {
   int mode;   /* VIM-like: normal, insert, visual*/
+  int engine; /* how row text is stored, see enum editorEngine */
   int cx, cy; /* (x, y) on data, 0 based */
   int rx, ry; /* (x, y) after rendering data(e.g. render TAB, etc.), 0 based */
   int tx, ty; /* (x, y) on screen(terminal), 1 based */
@@ -37,23 +146,41 @@ typedef struct editorConfig {
   int screencols;
   int searchResultRow;
   int searchResultCol;
-  int numrows; /* number of rows read in from disk */
-  row* data;   /* pointer of data read in from disk */
+  int numrows;  /* number of rows read in from disk */
+  rowTree rows; /* data read in from disk */
+  char* map;    /* read-only mapping of the opened file, NULL if not mapped */
+  size_t mapsize;
+  loader load;     /* background line scan of map */
+  int loading;     /* rows of map still arriving from the loader */
+  size_t loadoff;  /* offset in map where the next loaded row starts */
+  size_t* loadbuf; /* line ends taken from the loader */
+  int loadcap;
+  pieceTable pieces;   /* ENGINE_PIECES: original + add buffer */
+  row* hot;            /* ENGINE_PIECES: the one row with heap text */
+  pieceSnapshot undo;  /* ENGINE_PIECES: rows before the last change */
+  int* cache;          /* numbers of the rendered rows, a ring oldest first */
+  int cachecap;
+  int cachehead;
+  int cachelen;
+  char* query;   /* search being highlighted, NULL if none */
+  screen screen; /* cells on the terminal, see screen.h */
+  int frameoff;  /* rowoff of the last frame drawn, -1 if none */
+  char* gutter;  /* line numbers of the rows on screen, see gutterSync */
+  int guttertop; /* row number of the first one, -1 if none */
+  int gutterrows;
   int dirty;
   char keyStroke;
+  char typed[UTF8_MAX]; /* bytes of a character typed so far, see insertChar */
+  int typedlen;
   char* filename;
   char statusmsg[80];
   time_t statusmsg_time;
   time_t keystroke_time;
   struct termios orig_termios; /* terminal(STDIN) attribute */
+  input input;                 /* keys read but not processed yet */
+  int resizefd; /* signalfd of SIGWINCH, -1 if none, see enableResizeEvent */
 } editorConfig;
 
-/* buffer for STDOUT */
-typedef struct buffer {
-  char* start;
-  int size;
-} buffer;
-
 enum event {
   TAB = 9,
   BACKSPACE = 127,
@@ -67,7 +194,10 @@ enum event {
   PAGE_UP,
   PAGE_DOWN,
   MOUSE_UP,
-  MOUSE_DOWN
+  MOUSE_DOWN,
+  PASTE_START,
+  CURSOR_REPORT, /* \x1b[<row>;<col>R, see getCursorPosition */
+  MODE_REPORT    /* \x1b[?<mode>;<value>$y, see querySynchronizedOutput */
 };
 
 /* Syntax Highlight */
@@ -79,23 +209,43 @@ enum highlight {
 
 enum editorMode { NORMAL_MODE = 0, INSERT_MODE, VISUAL_MODE };
 
+enum editorEngine {
+  ENGINE_ROWS = 0, /* every edited row owns its text */
+  ENGINE_PIECES,   /* rows are pieces of a piece table, see piecetable.h */
+};
+
 // terminal setting
 void enableRawMode(struct termios*);
 void disableRawMode(struct termios*);
 void enableMouseEvent();
 void disableMouseEvent();
+void enableBracketedPaste();
+void disableBracketedPaste();
+void enableResizeEvent(editorConfig*);
+void querySynchronizedOutput();
 
 // editor
 void initEditor(editorConfig*);
 void updateEditor(editorConfig*);
-int getCursorPosition(int*, int*);
-int getWindowSize(int*, int*);
+int getCursorPosition(input*, int*, int*);
+int getWindowSize(input*, int*, int*);
 void editorOpen(editorConfig*, char*);
+void editorOpenMapped(editorConfig*, int, size_t);
+int editorLoadPoll(editorConfig*);
+void editorLoadWait(editorConfig*, int);
 void editorSave(editorConfig*);
 void editorQuit(editorConfig*);
+row* editorRow(editorConfig*, int);
+void editorGotoLine(editorConfig*, int);
+void editorGotoByte(editorConfig*, long);
+void editorCheckpoint(editorConfig*);
+void editorUndo(editorConfig*);
+void editorMemReport(editorConfig*);
+void editorSetTabWidth(editorConfig*, int);
+int editorPercent(editorConfig*);
 /* use callback to lower time complexity */
 void editorFindAll(editorConfig*, char*);
-void editorFindQuit(editorConfig*, char*);
+void editorFindQuit(editorConfig*);
 void editorFind(editorConfig*, char*);
 void editorFindForward(editorConfig*, char*);
 void editorFindBackward(editorConfig*, char*);
@@ -103,14 +253,21 @@ void editorFindBackward(editorConfig*, char*);
 // int rowCxToRx(row*, int);
 // data buffer
 void insertChar(editorConfig*, int);
+void editorInsertText(editorConfig*, const char*, size_t);
 void insertRow(editorConfig*, int, char*, size_t);
 void updateRow(editorConfig*, row*);
-void rowInsertChar(editorConfig*, row*, int, int);
+int rowInsertChar(editorConfig*, row*, int, int);
 void insertNewLine(editorConfig*);
 void deleteRow(editorConfig*, int);
 void rowAppendString(editorConfig*, row*, char*, size_t);
 void rowDelChar(editorConfig*, row*, int);
 void freerow(row*);
+void rowDetach(row*);
+void rowTouch(editorConfig*, row*);
+void rowCommit(editorConfig*, row*);
+char* rowChars(row*);
+void rowRenderSegments(row*, char* [2], int[2]);
+void rowMaterialize(editorConfig*, row*, int);
 void deleteChar(editorConfig*);
 void changeWord(editorConfig*);
 void deleteWord(editorConfig*);
@@ -118,24 +275,32 @@ void replaceChar(editorConfig*, int);
 char* rowsToString(editorConfig*, int*);
 
 void moveCursor(editorConfig*, int);
+void movePage(editorConfig*, int);
 
 // events
 int readInput(editorConfig*);
+long monotonicMs();
+int editorWait(editorConfig*, int);
+void editorPaste(editorConfig*);
 void processEvent(editorConfig*);
 void processNormalCommand(editorConfig*, char);
 void setStatusMessage(editorConfig*, const char*, ...);
 char* promptInfo(editorConfig*, char*);
 
+void bufferReserve(buffer*, int);
 void bufferAppend(buffer*, const char*, int);
 void bufferFree(buffer*);
 
 // screen render
-void renderRows(editorConfig*, buffer*);
-void renderStatusBar(editorConfig*, buffer*);
+void scrollScreen(editorConfig*);
+void renderRows(editorConfig*);
+void renderStatusBar(editorConfig*);
 int rowCxToRx(row*, int);
 int rowRxToCx(row*, int);
+extern int tabWidth;
+int tabColumns(int);
 void renderCursor(editorConfig*);
-void renderMessageBar(editorConfig*, buffer*);
+void renderMessageBar(editorConfig*);
 void renderScreen(editorConfig*);
 
 // syntax highlight
@@ -0,0 +1,282 @@
+#define _GNU_SOURCE
+
+#include <poll.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "editor.h"
+#include "input.h"
+
+#define MASK(i) ((i) & (INPUT_RING - 1))
+
+/* parser states */
+enum { S_GROUND, S_ESC, S_CSI, S_SS3, STATES };
+
+/* byte classes */
+enum { C_OTHER, C_ESC, C_BRACKET, C_O, C_PARAM, C_INTER, C_FINAL, CLASSES };
+
+/* what a byte does in a state */
+enum {
+  A_KEY,     /* the byte is a key by itself */
+  A_ESC,     /* start of a sequence, or a lone ESC */
+  A_CSI,     /* ESC [ */
+  A_SS3,     /* ESC O */
+  A_PARAM,   /* parameter or intermediate byte of a CSI */
+  A_LONE,    /* the ESC before doesn't start a sequence, it's a key */
+  A_CSI_END, /* final byte of a CSI */
+  A_SS3_END, /* final byte of an SS3 */
+  A_ABORT,   /* a byte that can't be in the sequence, which is dropped */
+};
+
+static const unsigned char byteClass[256] = {
+    [0x1b] = C_ESC,
+    [0x20 ... 0x2f] = C_INTER,
+    [0x30 ... 0x3f] = C_PARAM,
+    /* final bytes, but for 'O' and '[' */
+    [0x40 ... 'O' - 1] = C_FINAL,
+    ['O'] = C_O,
+    ['O' + 1 ... '[' - 1] = C_FINAL,
+    ['['] = C_BRACKET,
+    ['[' + 1 ... 0x7e] = C_FINAL,
+};
+
+static const unsigned char machine[STATES][CLASSES] = {
+    [S_GROUND] = {A_KEY, A_ESC, A_KEY, A_KEY, A_KEY, A_KEY, A_KEY},
+    [S_ESC] = {A_LONE, A_LONE, A_CSI, A_SS3, A_LONE, A_LONE, A_LONE},
+    [S_CSI] = {A_ABORT, A_ABORT, A_CSI_END, A_CSI_END, A_PARAM, A_PARAM,
+               A_CSI_END},
+    [S_SS3] = {A_ABORT, A_ABORT, A_SS3_END, A_SS3_END, A_SS3_END, A_LONE,
+               A_SS3_END},
+};
+
+/* Key of a complete CSI, 0 to drop it. */
+static int csiKey(input* in, int prefix, int final) {
+  if (prefix == '<') {
+    /* SGR mouse report, only the wheel is used */
+    if (final == 'M' && in->params[0] == 64)
+      return MOUSE_UP;
+    if (final == 'M' && in->params[0] == 65)
+      return MOUSE_DOWN;
+    return 0;
+  }
+  if (prefix == '?')
+    return final == 'y' ? MODE_REPORT : 0;
+  switch (final) {
+    case 'A':
+      return ARROW_UP;
+    case 'B':
+      return ARROW_DOWN;
+    case 'C':
+      return ARROW_RIGHT;
+    case 'D':
+      return ARROW_LEFT;
+    case 'H':
+      return HOME_KEY;
+    case 'F':
+      return END_KEY;
+    case 'R':
+      return CURSOR_REPORT;
+    case '~':
+      switch (in->params[0]) {
+        case 1:
+        case 7:
+          return HOME_KEY;
+        case 3:
+          return DEL_KEY;
+        case 4:
+        case 8:
+          return END_KEY;
+        case 5:
+          return PAGE_UP;
+        case 6:
+          return PAGE_DOWN;
+        case 200:
+          return PASTE_START;
+      }
+  }
+  return 0;
+}
+
+static int ss3Key(int final) {
+  switch (final) {
+    case 'A':
+      return ARROW_UP;
+    case 'B':
+      return ARROW_DOWN;
+    case 'C':
+      return ARROW_RIGHT;
+    case 'D':
+      return ARROW_LEFT;
+    case 'H':
+      return HOME_KEY;
+    case 'F':
+      return END_KEY;
+  }
+  return 0;
+}
+
+/* Parse one key from byte from, 0 if what was parsed is to be dropped (a
+ * NUL byte is too), and where the next one starts in *next unless it's
+ * INPUT_PARTIAL. */
+static int parseKey(input* in, unsigned int from, unsigned int* next,
+                    int flush) {
+  unsigned int at = from;
+  int state = S_GROUND;
+  int prefix = 0;
+  int n = 0;
+  memset(in->params, 0, sizeof(in->params));
+
+  while (at != in->tail) {
+    unsigned char c = in->ring[MASK(at++)];
+    switch (machine[state][byteClass[c]]) {
+      case A_KEY:
+        *next = at;
+        return c;
+      case A_ESC:
+        state = S_ESC;
+        break;
+      case A_CSI:
+        state = S_CSI;
+        break;
+      case A_SS3:
+        state = S_SS3;
+        break;
+      case A_PARAM:
+        if (c >= '0' && c <= '9') {
+          if (in->params[n] < 100000)
+            in->params[n] = in->params[n] * 10 + c - '0';
+        } else if (c == ';') {
+          if (n < INPUT_PARAMS - 1)
+            n++;
+        } else if (c >= 0x3c && at == from + 3) {
+          /* private marker right after ESC [, e.g. SGR mouse reports */
+          prefix = c;
+        }
+        break;
+      case A_LONE:
+        *next = from + 1;
+        return '\x1b';
+      case A_CSI_END:
+        *next = at;
+        return csiKey(in, prefix, c);
+      case A_SS3_END:
+        *next = at;
+        return ss3Key(c);
+      case A_ABORT:
+        /* e.g. a sequence cut short, its bytes aren't keys either; the one
+         * that cut it is parsed again, it may start the next */
+        *next = at - 1;
+        return 0;
+    }
+  }
+
+  /* ran out of input inside a sequence */
+  if (!flush)
+    return INPUT_PARTIAL;
+  *next = from + 1;
+  return '\x1b';
+}
+
+void inputInit(input* in, int fd) {
+  in->fd = fd;
+  in->head = 0;
+  in->tail = 0;
+}
+
+/* One read of whatever is available, as much as the ring takes. Returns
+ * the bytes read, 0 at end of input, -1 on error or if there's none. */
+int inputFill(input* in) {
+  unsigned int room = INPUT_RING - (in->tail - in->head);
+  if (room == 0)
+    return -1;
+  unsigned int end = MASK(in->tail);
+  struct iovec iov[2];
+  int n = 1;
+  iov[0].iov_base = &in->ring[end];
+  iov[0].iov_len = room < INPUT_RING - end ? room : INPUT_RING - end;
+  if (iov[0].iov_len < room) {
+    iov[1].iov_base = in->ring;
+    iov[1].iov_len = room - iov[0].iov_len;
+    n = 2;
+  }
+  ssize_t got = readv(in->fd, iov, n);
+  if (got > 0)
+    in->tail += got;
+  return got;
+}
+
+/* Whether there is input, buffered or within ms milliseconds. */
+int inputWait(input* in, int ms) {
+  if (in->head != in->tail)
+    return 1;
+  struct pollfd fd = {in->fd, POLLIN, 0};
+  return poll(&fd, 1, ms) > 0;
+}
+
+/* Next key in the buffer, INPUT_NONE or INPUT_PARTIAL if there isn't a
+ * whole one. With flush set, an unfinished sequence is taken as an ESC
+ * key followed by the keys of its bytes. Sequences that aren't keys, or
+ * are cut short by a byte that can't be in them, are dropped; the numbers
+ * of the last one are kept in params. */
+int inputKey(input* in, int flush) {
+  while (in->head != in->tail) {
+    /* a sequence filling the whole ring isn't going to end */
+    unsigned int next;
+    int key = parseKey(in, in->head, &next,
+                       flush || in->tail - in->head == INPUT_RING);
+    if (key == INPUT_PARTIAL)
+      return key;
+    in->head = next;
+    if (key != 0)
+      return key;
+  }
+  return INPUT_NONE;
+}
+
+/* Take the first key in the buffer that is reply, e.g. CURSOR_REPORT, out
+ * of it, leaving the keys around it for inputKey. Returns whether it was
+ * there, its numbers are in params then. */
+int inputTakeReply(input* in, int reply) {
+  unsigned int at = in->head;
+  while (at != in->tail) {
+    unsigned int next;
+    int key = parseKey(in, at, &next, 0);
+    if (key == INPUT_PARTIAL)
+      return 0;
+    if (key == reply) {
+      /* close up the keys before it */
+      unsigned int len = next - at;
+      while (at != in->head) {
+        at--;
+        in->ring[MASK(at + len)] = in->ring[MASK(at)];
+      }
+      in->head += len;
+      return 1;
+    }
+    at = next;
+  }
+  return 0;
+}
+
+/* Move the buffered input up to marker into out, returns whether the
+ * marker came, in which case it's dropped and what follows stays. */
+int inputTake(input* in, const char* marker, buffer* out) {
+  int mlen = strlen(marker);
+  /* the marker may have started in what was taken before */
+  int from = out->size > mlen - 1 ? out->size - (mlen - 1) : 0;
+  unsigned int n = in->tail - in->head;
+  bufferReserve(out, n);
+  for (unsigned int i = 0; i < n; i++)
+    out->start[out->size + i] = in->ring[MASK(in->head + i)];
+  out->size += n;
+  in->head += n;
+
+  char* at = memmem(&out->start[from], out->size - from, marker, mlen);
+  if (at == NULL)
+    return 0;
+  int after = out->size - (at - out->start) - mlen;
+  in->head -= after;
+  out->size = at - out->start;
+  return 1;
+}
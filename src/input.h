@@ -0,0 +1,34 @@
+#ifndef __input_h__
+#define __input_h__
+
+/* bytes of input buffered, a power of two */
+#define INPUT_RING (16 << 10)
+/* numbers kept from a control sequence, e.g. the row and column of a
+ * cursor position report */
+#define INPUT_PARAMS 4
+
+/* what inputKey returns besides keys */
+#define INPUT_NONE (-1)    /* nothing buffered */
+#define INPUT_PARTIAL (-2) /* a lone ESC or a sequence still coming */
+
+struct buffer;
+
+/* Input read a chunk at a time into a ring, then parsed into keys by a
+ * state machine, see inputKey. Nothing here blocks: the caller waits for
+ * input (inputWait) and decides how long an ESC may stay on its own. */
+typedef struct input {
+  int fd;
+  unsigned int head; /* next byte to parse, both count up forever */
+  unsigned int tail; /* next byte to fill */
+  int params[INPUT_PARAMS]; /* of the last control sequence */
+  unsigned char ring[INPUT_RING];
+} input;
+
+void inputInit(input*, int);
+int inputFill(input*);
+int inputWait(input*, int);
+int inputKey(input*, int);
+int inputTakeReply(input*, int);
+int inputTake(input*, const char*, struct buffer*);
+
+#endif
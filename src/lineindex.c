@@ -0,0 +1,198 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#include "dbg.h"
+#include "lineindex.h"
+
+/* Scalar fallback, memchr is already word-at-a-time in most libcs. */
+static size_t countNewlinesScalar(const char* p, size_t n) {
+  size_t count = 0;
+  const char* end = p + n;
+  while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+    count++;
+    p++;
+  }
+  return count;
+}
+
+static size_t* findNewlinesScalar(const char* p,
+                                  size_t n,
+                                  size_t base,
+                                  size_t* out) {
+  const char* start = p;
+  const char* end = p + n;
+  while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+    *out++ = base + (p - start) + 1;
+    p++;
+  }
+  return out;
+}
+
+#ifdef HAVE_X86_SIMD
+static size_t countNewlinesSSE2(const char* p, size_t n) {
+  const __m128i nl = _mm_set1_epi8('\n');
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+    count += __builtin_popcount(mask);
+  }
+  return count + countNewlinesScalar(p + i, n - i);
+}
+
+static size_t* findNewlinesSSE2(const char* p,
+                                size_t n,
+                                size_t base,
+                                size_t* out) {
+  const __m128i nl = _mm_set1_epi8('\n');
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+    while (mask) {
+      *out++ = base + i + __builtin_ctz(mask) + 1;
+      mask &= mask - 1;
+    }
+  }
+  return findNewlinesScalar(p + i, n - i, base + i, out);
+}
+
+__attribute__((target("avx2"))) static size_t countNewlinesAVX2(const char* p,
+                                                                 size_t n) {
+  const __m256i nl = _mm256_set1_epi8('\n');
+  size_t count = 0;
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+    unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+    count += __builtin_popcount(mask);
+  }
+  return count + countNewlinesSSE2(p + i, n - i);
+}
+
+__attribute__((target("avx2"))) static size_t* findNewlinesAVX2(const char* p,
+                                                                size_t n,
+                                                                size_t base,
+                                                                size_t* out) {
+  const __m256i nl = _mm256_set1_epi8('\n');
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(p + i));
+    unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+    while (mask) {
+      *out++ = base + i + __builtin_ctz(mask) + 1;
+      mask &= mask - 1;
+    }
+  }
+  return findNewlinesSSE2(p + i, n - i, base + i, out);
+}
+#endif
+
+static size_t (*countKernel)(const char*, size_t) = NULL;
+static size_t* (*findKernel)(const char*, size_t, size_t, size_t*) = NULL;
+
+static void pickKernels() {
+  if (countKernel)
+    return;
+  countKernel = countNewlinesScalar;
+  findKernel = findNewlinesScalar;
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    countKernel = countNewlinesAVX2;
+    findKernel = findNewlinesAVX2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    countKernel = countNewlinesSSE2;
+    findKernel = findNewlinesSSE2;
+  }
+#endif
+}
+
+/* one slice of the scanned range per worker */
+typedef struct scanJob {
+  const char* buf;
+  size_t start;
+  size_t len;
+  size_t count;
+  size_t* out;
+} scanJob;
+
+static void* countJob(void* arg) {
+  scanJob* job = arg;
+  job->count = countKernel(job->buf + job->start, job->len);
+  return NULL;
+}
+
+static void* findJob(void* arg) {
+  scanJob* job = arg;
+  findKernel(job->buf + job->start, job->len, job->start, job->out);
+  return NULL;
+}
+
+static void runJobs(scanJob* jobs, int njobs, void* (*fn)(void*)) {
+  pthread_t threads[LINE_INDEX_MAX_THREADS];
+  int started[LINE_INDEX_MAX_THREADS];
+  /* job 0 runs on the calling thread */
+  for (int i = 1; i < njobs; i++)
+    started[i] = pthread_create(&threads[i], NULL, fn, &jobs[i]) == 0;
+  fn(&jobs[0]);
+  for (int i = 1; i < njobs; i++) {
+    if (started[i])
+      pthread_join(threads[i], NULL);
+    else
+      fn(&jobs[i]);
+  }
+}
+
+/* End offset (one past the newline) of every line terminated in
+ * buf[from, to), in a malloc'ed array. Large ranges are split across
+ * worker threads: each slice counts its newlines, then once every slice
+ * knows where its output starts, writes them into one exactly sized array.
+ */
+size_t* lineIndexScan(const char* buf, size_t from, size_t to, int* count) {
+  pickKernels();
+
+  size_t size = to - from;
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  int njobs = size / LINE_INDEX_MIN_CHUNK;
+  if (njobs > ncpu)
+    njobs = ncpu;
+  if (njobs > LINE_INDEX_MAX_THREADS)
+    njobs = LINE_INDEX_MAX_THREADS;
+  if (njobs < 1)
+    njobs = 1;
+
+  scanJob jobs[LINE_INDEX_MAX_THREADS];
+  size_t slice = size / njobs;
+  for (int i = 0; i < njobs; i++) {
+    jobs[i].buf = buf;
+    jobs[i].start = from + i * slice;
+    jobs[i].len = (i == njobs - 1) ? to - jobs[i].start : slice;
+  }
+  runJobs(jobs, njobs, countJob);
+
+  size_t newlines = 0;
+  for (int i = 0; i < njobs; i++)
+    newlines += jobs[i].count;
+
+  size_t* ends = malloc(sizeof(size_t) * (newlines + 1));
+  check(ends == NULL, "Fail to allocate line index");
+  size_t* out = ends;
+  for (int i = 0; i < njobs; i++) {
+    jobs[i].out = out;
+    out += jobs[i].count;
+  }
+  runJobs(jobs, njobs, findJob);
+
+  *count = newlines;
+  return ends;
+}
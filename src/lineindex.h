@@ -0,0 +1,13 @@
+#ifndef __lineindex_h__
+#define __lineindex_h__
+
+#include <stddef.h>
+
+/* Below this many bytes per worker the thread start-up cost outweighs the
+ * scan itself. */
+#define LINE_INDEX_MIN_CHUNK (4 << 20)
+#define LINE_INDEX_MAX_THREADS 16
+
+size_t* lineIndexScan(const char*, size_t, size_t, int*);
+
+#endif
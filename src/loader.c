@@ -0,0 +1,121 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dbg.h"
+#include "lineindex.h"
+#include "loader.h"
+
+static void loaderPublish(loader* l, size_t* ends, int count, size_t to) {
+  pthread_mutex_lock(&l->lock);
+  if (l->nends + count > l->cap) {
+    int cap = l->cap ? l->cap : 1024;
+    while (l->nends + count > cap)
+      cap *= 2;
+    l->ends = realloc(l->ends, sizeof(size_t) * cap);
+    check(l->ends == NULL, "Fail to allocate line index");
+    l->cap = cap;
+  }
+  memcpy(&l->ends[l->nends], ends, sizeof(size_t) * count);
+  l->nends += count;
+  l->scanned = to;
+  if (to == l->size)
+    l->done = 1;
+  pthread_cond_broadcast(&l->cond);
+  pthread_mutex_unlock(&l->lock);
+  /* a full pipe already has a wakeup pending */
+  write(l->wake[1], "", 1);
+}
+
+static void* loaderRun(void* arg) {
+  loader* l = arg;
+  size_t from = 0;
+  size_t chunk = LOADER_FIRST_CHUNK;
+
+  while (from < l->size) {
+    size_t to = from + chunk < l->size ? from + chunk : l->size;
+    int count;
+    size_t* ends = lineIndexScan(l->buf, from, to, &count);
+    /* a last line without trailing newline is still a line */
+    if (to == l->size && l->buf[to - 1] != '\n')
+      ends[count++] = to;
+    loaderPublish(l, ends, count, to);
+    free(ends);
+
+    from = to;
+    if (chunk < LOADER_MAX_CHUNK)
+      chunk *= 2;
+  }
+  if (l->size == 0)
+    loaderPublish(l, NULL, 0, 0);
+  return NULL;
+}
+
+void loaderStart(loader* l, const char* buf, size_t size) {
+  pthread_mutex_init(&l->lock, NULL);
+  pthread_cond_init(&l->cond, NULL);
+  l->buf = buf;
+  l->size = size;
+  l->ends = NULL;
+  l->nends = 0;
+  l->cap = 0;
+  l->scanned = 0;
+  l->done = 0;
+  check(pipe(l->wake) == -1, "Fail to create loader pipe");
+  for (int i = 0; i < 2; i++) {
+    fcntl(l->wake[i], F_SETFL, O_NONBLOCK);
+    fcntl(l->wake[i], F_SETFD, FD_CLOEXEC);
+  }
+  l->running = 1;
+  if (pthread_create(&l->thread, NULL, loaderRun, l) != 0) {
+    /* no thread, load synchronously */
+    loaderRun(l);
+    l->running = 0;
+  }
+}
+
+/* Swap the caller's (empty) buffer with the published line ends and return
+ * how many there are, *done tells whether they were the last ones. With
+ * wait set, blocks until at least one chunk or the end of the buffer
+ * arrives. */
+int loaderTake(loader* l, size_t** ends, int* cap, int wait, int* done) {
+  /* whatever was published so far is taken, so are its wakeups */
+  char drain[64];
+  while (read(l->wake[0], drain, sizeof(drain)) > 0) {
+  }
+
+  pthread_mutex_lock(&l->lock);
+  while (wait && l->nends == 0 && !l->done)
+    pthread_cond_wait(&l->cond, &l->lock);
+
+  int count = l->nends;
+  size_t* mine = *ends;
+  int mycap = *cap;
+  *ends = l->ends;
+  *cap = l->cap;
+  l->ends = mine;
+  l->cap = mycap;
+  l->nends = 0;
+  *done = l->done;
+  pthread_mutex_unlock(&l->lock);
+  return count;
+}
+
+/* Readable once chunks are published, for poll. loaderTake clears it. */
+int loaderFd(loader* l) {
+  return l->wake[0];
+}
+
+void loaderStop(loader* l) {
+  if (l->running) {
+    pthread_join(l->thread, NULL);
+    l->running = 0;
+  }
+  close(l->wake[0]);
+  close(l->wake[1]);
+  free(l->ends);
+  l->ends = NULL;
+  l->nends = 0;
+  l->cap = 0;
+}
@@ -0,0 +1,35 @@
+#ifndef __loader_h__
+#define __loader_h__
+
+#include <pthread.h>
+#include <stddef.h>
+
+/* The first chunk only has to cover the first screen, later chunks double
+ * up to LOADER_MAX_CHUNK. */
+#define LOADER_FIRST_CHUNK (64 << 10)
+#define LOADER_MAX_CHUNK (64 << 20)
+
+/* Background scan of a read-only buffer for line ends. The loader thread
+ * publishes them in chunks, the editor thread takes whatever has been
+ * published and turns it into rows. */
+typedef struct loader {
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond; /* signalled whenever a chunk is published */
+  const char* buf;
+  size_t size;
+  size_t* ends; /* line end offsets published but not taken yet */
+  int nends;
+  int cap;
+  size_t scanned; /* bytes of buf scanned so far */
+  int running;    /* thread started and not joined yet */
+  int done;       /* all of buf scanned and published */
+  int wake[2];    /* pipe written to on every publish, see loaderFd */
+} loader;
+
+void loaderStart(loader*, const char*, size_t);
+int loaderTake(loader*, size_t**, int*, int, int*);
+int loaderFd(loader*);
+void loaderStop(loader*);
+
+#endif
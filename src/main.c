@@ -3,9 +3,10 @@
 #define _GNU_SOURCE
 
 #include <errno.h>
-#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "dbg.h"
@@ -13,39 +14,51 @@
 
 editorConfig E;
 
-static void sigwinchHandler(int sig) {
-  if (SIGWINCH == sig) {
-    updateEditor(&E);
-    renderScreen(&E);
-  }
-}
-
 int main(int argc, char** argv) {
-  if (argc >= 3) {
-    log_info("Usage: kilo <filename>(optional)");
+  int engine = ENGINE_ROWS;
+  int argi = 1;
+  if (argi < argc && strcmp(argv[argi], "-p") == 0) {
+    engine = ENGINE_PIECES;
+    argi++;
+  }
+  if (argc - argi >= 2) {
+    log_info("Usage: kilo [-p] <filename>(optional)");
   }
 
   // enableMouseEvent();
   enableRawMode(&(E.orig_termios));
+  enableBracketedPaste();
+  querySynchronizedOutput();
 
   initEditor(&E);
+  E.engine = engine;
+  /* before the loader and screen threads start */
+  enableResizeEvent(&E);
+  screenStart(&E.screen, STDOUT_FILENO);
 
-  if (argc == 2) {
-    editorOpen(&E, argv[1]);
+  if (argi < argc) {
+    editorOpen(&E, argv[argi]);
   } else {
     insertRow(&E, E.cy, "", 1);
   }
 
-  /* listen for Window Size change */
-  signal(SIGWINCH, sigwinchHandler);
-
   setStatusMessage(&E, "HELP: Ctrl-S = save | Ctrl-Q = quit");
 
   while (1) {
     renderScreen(&E);
-    processEvent(&E);
+    long drawn = monotonicMs();
+    /* Input arriving before the next frame is due joins this batch, so a
+     * burst of keys costs one frame. Once it stops, the frame is drawn.
+     * The view still follows the cursor key by key, as if each was drawn. */
+    long wait;
+    do {
+      processEvent(&E);
+      scrollScreen(&E);
+      wait = drawn + 1000 / MAX_FPS - monotonicMs();
+    } while (inputWait(&E.input, wait > 0 ? wait : 0));
   }
 
+  disableBracketedPaste();
   disableRawMode(&(E.orig_termios));
   // disableMouseEvent();
 
@@ -0,0 +1,37 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "dbg.h"
+#include "piecetable.h"
+
+/* Copy text to the end of the add buffer, the returned pointer stays valid
+ * until the table is freed. */
+const char* pieceAppend(pieceTable* pt, const char* s, int len) {
+  if (pt->nblocks == 0 || pt->used + len > pt->cap) {
+    size_t cap = len > PIECE_BLOCK_SIZE ? len : PIECE_BLOCK_SIZE;
+    pt->blocks = realloc(pt->blocks, sizeof(char*) * (pt->nblocks + 1));
+    check(pt->blocks == NULL, "Fail to grow add buffer");
+    pt->blocks[pt->nblocks] = malloc(cap);
+    check(pt->blocks[pt->nblocks] == NULL, "Fail to grow add buffer");
+    pt->nblocks++;
+    pt->used = 0;
+    pt->cap = cap;
+  }
+  char* p = &pt->blocks[pt->nblocks - 1][pt->used];
+  memcpy(p, s, len);
+  pt->used += len;
+  pt->addsize += len;
+  return p;
+}
+
+void pieceTableFree(pieceTable* pt) {
+  for (int i = 0; i < pt->nblocks; i++)
+    free(pt->blocks[i]);
+  free(pt->blocks);
+  *pt = (pieceTable)PIECE_TABLE_INIT;
+}
+
+void pieceSnapshotFree(pieceSnapshot* snap) {
+  free(snap->pieces);
+  *snap = (pieceSnapshot)PIECE_SNAPSHOT_INIT;
+}
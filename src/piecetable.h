@@ -0,0 +1,47 @@
+#ifndef __piecetable_h__
+#define __piecetable_h__
+
+#include <stddef.h>
+
+/* add buffer grows in blocks of at least this size */
+#define PIECE_BLOCK_SIZE (64 << 10)
+
+/* A piece is a run of text in either the original buffer or the add
+ * buffer. The table is line granular: every row of the document is one
+ * piece, so the row array doubles as the piece descriptor list. */
+typedef struct piece {
+  const char* text;
+  int len;
+} piece;
+
+/* Read-only original buffer (the file mapping) plus an append-only add
+ * buffer. Text in either never moves or changes, so pieces and snapshots
+ * stay valid for the lifetime of the table. */
+typedef struct pieceTable {
+  const char* orig;
+  size_t origsize;
+  char** blocks; /* add buffer blocks, the last one is being filled */
+  int nblocks;
+  size_t used; /* bytes used in the last block */
+  size_t cap;  /* size of the last block */
+  size_t addsize;
+} pieceTable;
+
+#define PIECE_TABLE_INIT \
+  { NULL, 0, NULL, 0, 0, 0, 0 }
+
+/* Rows as pieces at one point in time, plus where the cursor was. */
+typedef struct pieceSnapshot {
+  piece* pieces;
+  int n;
+  int cx, cy;
+} pieceSnapshot;
+
+#define PIECE_SNAPSHOT_INIT \
+  { NULL, 0, 0, 0 }
+
+const char* pieceAppend(pieceTable*, const char*, int);
+void pieceTableFree(pieceTable*);
+void pieceSnapshotFree(pieceSnapshot*);
+
+#endif
@@ -0,0 +1,114 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "dbg.h"
+#include "pool.h"
+
+#ifndef POOL_MALLOC
+
+#define POOL_CLASSES 13 /* POOL_MIN << 12 == POOL_MAX */
+
+typedef struct poolBlock {
+  struct poolBlock* next;
+} poolBlock;
+
+/* per thread, so that the screen writer's frame buffer takes nothing from
+ * the editor's lists and neither has to lock */
+static __thread poolBlock* freeList[POOL_CLASSES];
+
+/* n <= POOL_MIN is class 0, each class doubles the block size */
+static int poolClass(size_t n) {
+  if (n <= POOL_MIN)
+    return 0;
+  return (int)(sizeof(long) * 8 - __builtin_clzl(n - 1)) -
+         __builtin_ctz(POOL_MIN);
+}
+
+static void poolRefill(int c) {
+  size_t size = (size_t)POOL_MIN << c;
+  size_t count = POOL_SLAB / size;
+  char* slab = malloc(size * count);
+  check(slab == NULL, "Fail to allocate pool");
+  for (size_t i = count; i-- > 0;) {
+    poolBlock* b = (poolBlock*)&slab[i * size];
+    b->next = freeList[c];
+    freeList[c] = b;
+  }
+}
+
+size_t poolSize(size_t n) {
+  if (n > POOL_MAX)
+    return n;
+  return (size_t)POOL_MIN << poolClass(n);
+}
+
+void* poolAlloc(size_t n) {
+  if (n > POOL_MAX) {
+    void* p = malloc(n);
+    check(p == NULL, "Fail to allocate");
+    return p;
+  }
+  int c = poolClass(n);
+  if (freeList[c] == NULL)
+    poolRefill(c);
+  poolBlock* b = freeList[c];
+  freeList[c] = b->next;
+  return b;
+}
+
+void poolFree(void* p, size_t n) {
+  if (p == NULL)
+    return;
+  if (n > POOL_MAX) {
+    free(p);
+    return;
+  }
+  poolBlock* b = p;
+  int c = poolClass(n);
+  b->next = freeList[c];
+  freeList[c] = b;
+}
+
+/* Resize p from old to n bytes, in place when both round to the same
+ * block. */
+void* poolRealloc(void* p, size_t old, size_t n) {
+  if (p == NULL)
+    return poolAlloc(n);
+  if (old > POOL_MAX && n > POOL_MAX) {
+    p = realloc(p, n);
+    check(p == NULL, "Fail to allocate");
+    return p;
+  }
+  if (poolSize(old) == poolSize(n))
+    return p;
+  void* q = poolAlloc(n);
+  memcpy(q, p, old < n ? old : n);
+  poolFree(p, old);
+  return q;
+}
+
+#else
+
+size_t poolSize(size_t n) {
+  return n;
+}
+
+void* poolAlloc(size_t n) {
+  void* p = malloc(n ? n : 1);
+  check(p == NULL, "Fail to allocate");
+  return p;
+}
+
+void poolFree(void* p, size_t n) {
+  (void)n;
+  free(p);
+}
+
+void* poolRealloc(void* p, size_t old, size_t n) {
+  (void)old;
+  p = realloc(p, n ? n : 1);
+  check(p == NULL, "Fail to allocate");
+  return p;
+}
+
+#endif
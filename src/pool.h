@@ -0,0 +1,29 @@
+#ifndef __pool_h__
+#define __pool_h__
+
+#include <stddef.h>
+
+/* smallest and largest pooled block, both powers of two */
+#define POOL_MIN 16
+#define POOL_MAX (64 << 10)
+/* bytes carved into blocks of one class at a time */
+#define POOL_SLAB (64 << 10)
+
+/* Size-class allocator for row text, render and frame buffers. Requests
+ * are rounded up to a power of two and served from a free list per class,
+ * refilled a slab at a time; bigger ones go to malloc. Freed blocks go back
+ * to their list, slabs are never returned.
+ *
+ * Callers pass the size they asked for when freeing or resizing, there are
+ * no headers. poolSize tells how much a request really gets, so a buffer
+ * can grow into it without calling the pool at all. Each thread has its own
+ * free lists, a block is to be freed by the thread that allocated it.
+ *
+ * Build with -DPOOL_MALLOC to have every call go straight to libc, e.g. to
+ * compare the two. */
+size_t poolSize(size_t);
+void* poolAlloc(size_t);
+void poolFree(void*, size_t);
+void* poolRealloc(void*, size_t, size_t);
+
+#endif
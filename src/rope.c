@@ -0,0 +1,504 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "dbg.h"
+#include "editor.h"
+#include "rope.h"
+#include "utf8.h"
+
+static int height(rope* n) {
+  return n ? n->height : -1;
+}
+
+/* Column reached after the text below m, starting at column col. A tab
+ * jumps to the next tab stop, so once there is one the rest no longer
+ * depends on where the text started: only the columns before the first
+ * tab (head) and after it (tail) need to be kept. */
+static int ropeAdvance(const rope* m, int col) {
+  if (!m->tabbed)
+    return col + m->head;
+  col += m->head;
+  return col + tabColumns(col) + m->tail;
+}
+
+/* Columns of the n bytes at s, which hold no tab. */
+static int textColumns(const char* s, int n) {
+  int col = 0;
+  int j = 0;
+  while (j < n) {
+    int k = utf8Span(&s[j], n - j);
+    col += k;
+    j += k;
+    if (j < n) {
+      int cp;
+      j += utf8Char(&s[j], n - j, &cp);
+      col += utf8Width(cp);
+    }
+  }
+  return col;
+}
+
+/* A leaf is measured on its own, so a character cut across two leaves
+ * would count as bytes that aren't one, build doesn't cut any. */
+static void measureLeaf(rope* n) {
+  n->height = 0;
+  n->tail = 0;
+  char* end = n->text + n->size;
+  char* tab = memchr(n->text, '\t', n->size);
+  n->tabbed = tab != NULL;
+  if (tab == NULL) {
+    n->head = textColumns(n->text, n->size);
+    return;
+  }
+
+  n->head = textColumns(n->text, tab - n->text);
+  int col = 0;
+  char* p = tab + 1;
+  while ((tab = memchr(p, '\t', end - p)) != NULL) {
+    col += textColumns(p, tab - p);
+    col += tabColumns(col);
+    p = tab + 1;
+  }
+  n->tail = col + textColumns(p, end - p);
+}
+
+static void measure(rope* n) {
+  rope* l = n->left;
+  rope* r = n->right;
+  n->size = l->size + r->size;
+  n->height = 1 + (l->height > r->height ? l->height : r->height);
+  n->tabbed = l->tabbed || r->tabbed;
+  if (l->tabbed) {
+    n->head = l->head;
+    /* l->tail starts at a tab stop, so it's a valid start for r */
+    n->tail = ropeAdvance(r, l->tail);
+  } else {
+    n->head = l->head + r->head;
+    n->tail = r->tail;
+  }
+}
+
+static rope* newLeaf(const char* text, int len, int copy) {
+  rope* n = calloc(1, sizeof(rope));
+  check(n == NULL, "Fail to allocate rope");
+  if (copy) {
+    n->text = malloc(ROPE_LEAF_MAX);
+    check(n->text == NULL, "Fail to allocate rope");
+    memcpy(n->text, text, len);
+    n->owned = 1;
+  } else {
+    n->text = (char*)text;
+  }
+  n->size = len;
+  measureLeaf(n);
+  return n;
+}
+
+static rope* newNode(rope* l, rope* r) {
+  rope* n = calloc(1, sizeof(rope));
+  check(n == NULL, "Fail to allocate rope");
+  n->left = l;
+  n->right = r;
+  measure(n);
+  return n;
+}
+
+/* copy-on-write: give a leaf pointing into shared text its own buffer */
+static void ownLeaf(rope* n) {
+  if (n->owned)
+    return;
+  char* text = malloc(ROPE_LEAF_MAX);
+  check(text == NULL, "Fail to allocate rope");
+  memcpy(text, n->text, n->size);
+  n->text = text;
+  n->owned = 1;
+}
+
+static rope* rotateRight(rope* n) {
+  rope* l = n->left;
+  n->left = l->right;
+  l->right = n;
+  measure(n);
+  measure(l);
+  return l;
+}
+
+static rope* rotateLeft(rope* n) {
+  rope* r = n->right;
+  n->right = r->left;
+  r->left = n;
+  measure(n);
+  measure(r);
+  return r;
+}
+
+static rope* balance(rope* n) {
+  measure(n);
+  if (height(n->left) > height(n->right) + 1) {
+    if (height(n->left->left) < height(n->left->right))
+      n->left = rotateLeft(n->left);
+    return rotateRight(n);
+  }
+  if (height(n->right) > height(n->left) + 1) {
+    if (height(n->right->right) < height(n->right->left))
+      n->right = rotateRight(n->right);
+    return rotateLeft(n);
+  }
+  return n;
+}
+
+/* Concatenate two balanced trees of any heights: walk down the spine of the
+ * taller one until the heights meet, rebalancing on the way back up. */
+static rope* join(rope* l, rope* r) {
+  if (l == NULL)
+    return r;
+  if (r == NULL)
+    return l;
+  if (l->height > r->height + 1) {
+    l->right = join(l->right, r);
+    return balance(l);
+  }
+  if (r->height > l->height + 1) {
+    r->left = join(l, r->left);
+    return balance(r);
+  }
+  return newNode(l, r);
+}
+
+/* Put n back together from its possibly changed children, reusing n when
+ * it's still balanced. */
+static rope* rejoin(rope* n, rope* l, rope* r) {
+  int diff = height(l) - height(r);
+  if (l && r && diff <= 1 && diff >= -1) {
+    n->left = l;
+    n->right = r;
+    measure(n);
+    return n;
+  }
+  free(n);
+  return join(l, r);
+}
+
+/* Cut n after its first at bytes into *l and *r. */
+static void split(rope* n, int at, rope** l, rope** r) {
+  if (n == NULL || at <= 0) {
+    *l = NULL;
+    *r = n;
+    return;
+  }
+  if (at >= n->size) {
+    *l = n;
+    *r = NULL;
+    return;
+  }
+  if (n->left == NULL) {
+    *r = newLeaf(n->text + at, n->size - at, n->owned);
+    n->size = at;
+    measureLeaf(n);
+    *l = n;
+    return;
+  }
+
+  rope* left = n->left;
+  rope* right = n->right;
+  rope* m;
+  free(n);
+  if (at <= left->size) {
+    split(left, at, l, &m);
+    *r = join(m, right);
+  } else {
+    split(right, at - left->size, &m, r);
+    *l = join(left, m);
+  }
+}
+
+static rope* build(const char* text, int len, int leaves, int copy) {
+  if (leaves == 1)
+    return newLeaf(text, len, copy);
+  int half = leaves / 2;
+  int llen = (long long)len * half / leaves;
+  /* back to the start of the character there, if it's in the middle of one */
+  for (int k = 0; k < UTF8_MAX - 1 && llen > 0; k++) {
+    if ((text[llen] & 0xc0) != 0x80)
+      break;
+    llen--;
+  }
+  return newNode(build(text, llen, half, copy),
+                 build(text + llen, len - llen, leaves - half, copy));
+}
+
+/* Balanced rope of text, in evenly filled leaves. Without copy the leaves
+ * point into text, which must stay valid and unchanged. Cutting on
+ * characters moves up to UTF8_MAX bytes to the right half at each level,
+ * which adds up to less than 3 * UTF8_MAX down any path, so leaves are
+ * filled that much short of ROPE_LEAF_MAX to never go past it. */
+rope* ropeBuild(const char* text, int len, int copy) {
+  if (len <= 0)
+    return NULL;
+  int fill = ROPE_LEAF_MAX - 3 * UTF8_MAX;
+  return build(text, len, (len + fill - 1) / fill, copy);
+}
+
+/* Measure every node again, e.g. once the tab width changed. */
+void ropeMeasure(rope* n) {
+  if (n == NULL)
+    return;
+  if (n->left == NULL) {
+    measureLeaf(n);
+    return;
+  }
+  ropeMeasure(n->left);
+  ropeMeasure(n->right);
+  measure(n);
+}
+
+void ropeFree(rope* n) {
+  if (n == NULL)
+    return;
+  ropeFree(n->left);
+  ropeFree(n->right);
+  if (n->owned)
+    free(n->text);
+  free(n);
+}
+
+rope* ropeInsert(rope* n, int at, const char* s, int len) {
+  if (len <= 0)
+    return n;
+  if (n == NULL)
+    return ropeBuild(s, len, 1);
+
+  if (n->left) {
+    rope* l = n->left;
+    rope* r = n->right;
+    if (at <= l->size)
+      l = ropeInsert(l, at, s, len);
+    else
+      r = ropeInsert(r, at - l->size, s, len);
+    return rejoin(n, l, r);
+  }
+
+  if (n->size + len <= ROPE_LEAF_MAX) {
+    ownLeaf(n);
+    memmove(&n->text[at + len], &n->text[at], n->size - at);
+    memcpy(&n->text[at], s, len);
+    n->size += len;
+    measureLeaf(n);
+    return n;
+  }
+
+  /* the leaf overflows, spread it and the new text over new leaves */
+  int size = n->size + len;
+  char* text = malloc(size);
+  check(text == NULL, "Fail to allocate rope");
+  memcpy(text, n->text, at);
+  memcpy(&text[at], s, len);
+  memcpy(&text[at + len], &n->text[at], n->size - at);
+  ropeFree(n);
+  n = ropeBuild(text, size, 1);
+  free(text);
+  return n;
+}
+
+rope* ropeDelete(rope* n, int at, int len) {
+  if (n == NULL || at < 0 || at >= n->size)
+    return n;
+  if (len > n->size - at)
+    len = n->size - at;
+  if (len <= 0)
+    return n;
+
+  /* common case: the range is inside one subtree, which doesn't empty */
+  if (n->left == NULL && len < n->size) {
+    ownLeaf(n);
+    memmove(&n->text[at], &n->text[at + len], n->size - at - len);
+    n->size -= len;
+    measureLeaf(n);
+    return n;
+  }
+  if (n->left) {
+    rope* l = n->left;
+    rope* r = n->right;
+    if (at + len <= l->size && len < l->size)
+      return rejoin(n, ropeDelete(l, at, len), r);
+    if (at >= l->size && len < r->size)
+      return rejoin(n, l, ropeDelete(r, at - l->size, len));
+  }
+
+  rope *a, *b, *m, *c;
+  split(n, at, &a, &b);
+  split(b, len, &m, &c);
+  ropeFree(m);
+  return join(a, c);
+}
+
+rope* ropeConcat(rope* l, rope* r) {
+  return join(l, r);
+}
+
+/* Cut n after its first at bytes, returns the head and stores the rest in
+ * *right. */
+rope* ropeSplit(rope* n, int at, rope** right) {
+  rope* left;
+  split(n, at, &left, right);
+  return left;
+}
+
+void ropeCopy(rope* n, int at, int len, char* out) {
+  if (n == NULL || len <= 0)
+    return;
+  if (n->left == NULL) {
+    memcpy(out, &n->text[at], len);
+    return;
+  }
+  int lsize = n->left->size;
+  if (at < lsize) {
+    int k = len < lsize - at ? len : lsize - at;
+    ropeCopy(n->left, at, k, out);
+    out += k;
+    len -= k;
+    at = lsize;
+  }
+  ropeCopy(n->right, at - lsize, len, out);
+}
+
+/* Call fn on the text of every leaf, in order. */
+void ropeEach(rope* n, void (*fn)(const char*, int, void*), void* arg) {
+  if (n == NULL)
+    return;
+  if (n->left == NULL) {
+    fn(n->text, n->size, arg);
+    return;
+  }
+  ropeEach(n->left, fn, arg);
+  ropeEach(n->right, fn, arg);
+}
+
+typedef struct ropeSearch {
+  const char* query;
+  int qlen;
+  char* window; /* last qlen - 1 bytes seen, then the current leaf */
+  int keep;
+  int pos; /* bytes before the current leaf */
+} ropeSearch;
+
+static int findIn(rope* n, ropeSearch* s) {
+  if (n->left) {
+    int at = findIn(n->left, s);
+    return at != -1 ? at : findIn(n->right, s);
+  }
+
+  /* the tail of the previous leaves catches matches across the boundary */
+  memcpy(&s->window[s->keep], n->text, n->size);
+  int len = s->keep + n->size;
+  int i = 0;
+  while (i + s->qlen <= len) {
+    char* p = memchr(&s->window[i], s->query[0], len - s->qlen - i + 1);
+    if (p == NULL)
+      break;
+    i = p - s->window;
+    if (memcmp(p, s->query, s->qlen) == 0)
+      return s->pos - s->keep + i;
+    i++;
+  }
+
+  s->pos += n->size;
+  s->keep = len < s->qlen - 1 ? len : s->qlen - 1;
+  memmove(s->window, &s->window[len - s->keep], s->keep);
+  return -1;
+}
+
+/* Byte offset of the first occurrence of query, or -1. */
+int ropeFind(rope* n, const char* query) {
+  int qlen = strlen(query);
+  if (qlen == 0)
+    return 0;
+  if (n == NULL)
+    return -1;
+
+  ropeSearch s = {query, qlen, malloc(qlen + ROPE_LEAF_MAX), 0, 0};
+  check(s.window == NULL, "Fail to allocate rope search");
+  int at = findIn(n, &s);
+  free(s.window);
+  return at;
+}
+
+/* Display column of byte at, tabs expanded and characters as wide as they
+ * show. */
+int ropeColumn(rope* n, int at) {
+  if (n == NULL)
+    return 0;
+  if (at > n->size)
+    at = n->size;
+  int col = 0;
+  while (n->left) {
+    if (at <= n->left->size) {
+      n = n->left;
+    } else {
+      col = ropeAdvance(n->left, col);
+      at -= n->left->size;
+      n = n->right;
+    }
+  }
+  int j = 0;
+  while (j < at) {
+    int k = utf8Span(&n->text[j], at - j);
+    col += k;
+    j += k;
+    if (j == at)
+      break;
+    if (n->text[j] == '\t') {
+      col += tabColumns(col);
+      j++;
+      continue;
+    }
+    int cp;
+    int len = utf8Char(&n->text[j], n->size - j, &cp);
+    /* at is within this character, which starts at col */
+    if (j + len > at)
+      break;
+    col += utf8Width(cp);
+    j += len;
+  }
+  return col;
+}
+
+/* Byte displayed at column col, the size of the text past its end. */
+int ropeByteAt(rope* n, int col) {
+  if (n == NULL)
+    return 0;
+  int at = 0;
+  int cur = 0;
+  while (n->left) {
+    int end = ropeAdvance(n->left, cur);
+    if (col < end) {
+      n = n->left;
+    } else {
+      cur = end;
+      at += n->left->size;
+      n = n->right;
+    }
+  }
+  int j = 0;
+  while (j < n->size) {
+    int k = utf8Span(&n->text[j], n->size - j);
+    if (cur + k > col)
+      return at + j + (col > cur ? col - cur : 0);
+    cur += k;
+    j += k;
+    if (j == n->size)
+      break;
+    int len = 1;
+    if (n->text[j] == '\t') {
+      cur += tabColumns(cur);
+    } else {
+      int cp;
+      len = utf8Char(&n->text[j], n->size - j, &cp);
+      cur += utf8Width(cp);
+    }
+    if (cur > col)
+      return at + j;
+    j += len;
+  }
+  return at + n->size;
+}
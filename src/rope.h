@@ -0,0 +1,39 @@
+#ifndef __rope_h__
+#define __rope_h__
+
+/* most bytes in one leaf */
+#define ROPE_LEAF_MAX 4096
+
+/* Balanced (AVL) tree of text chunks for very long rows. Every node keeps
+ * the number of bytes below it and how they advance the display column, so
+ * byte <-> column conversion and edits are O(log n) instead of O(size).
+ *
+ * Leaves either own their text (a ROPE_LEAF_MAX buffer) or point into
+ * read-only text that outlives the rope, e.g. the file mapping, and are
+ * copied on the first edit. A NULL rope is the empty text. */
+typedef struct rope {
+  struct rope* left; /* NULL for a leaf */
+  struct rope* right;
+  char* text;   /* leaf text */
+  int owned;    /* leaf text is ours */
+  int size;     /* bytes */
+  int height;   /* 0 for a leaf */
+  int tabbed;   /* at least one tab, see ropeAdvance */
+  int head;     /* columns before the first tab, all of them without one */
+  int tail;     /* columns after the first tab, from a tab stop */
+} rope;
+
+rope* ropeBuild(const char*, int, int);
+void ropeFree(rope*);
+rope* ropeInsert(rope*, int, const char*, int);
+rope* ropeDelete(rope*, int, int);
+rope* ropeConcat(rope*, rope*);
+rope* ropeSplit(rope*, int, rope**);
+void ropeCopy(rope*, int, int, char*);
+void ropeEach(rope*, void (*)(const char*, int, void*), void*);
+int ropeFind(rope*, const char*);
+int ropeColumn(rope*, int);
+int ropeByteAt(rope*, int);
+void ropeMeasure(rope*);
+
+#endif
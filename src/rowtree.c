@@ -0,0 +1,392 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dbg.h"
+#include "editor.h"
+#include "rowtree.h"
+
+typedef struct rowNode {
+  int leaf;
+  int n;      /* rows of a leaf, children of an inner node */
+  int count;  /* rows in this subtree */
+  long bytes; /* text in this subtree, with a newline after every row */
+  struct rowInner* parent;
+} rowNode;
+
+/* Leaves are ROWTREE_LEAF_BYTES long and aligned to that, so the leaf
+ * holding a row is found from the row's address, see leafOf. */
+typedef struct rowLeaf {
+  rowNode node;
+  struct rowLeaf* prev;
+  struct rowLeaf* next;
+  row rows[];
+} rowLeaf;
+
+#define LEAF_MAX ((int)((ROWTREE_LEAF_BYTES - sizeof(rowLeaf)) / sizeof(row)))
+
+typedef struct rowInner {
+  rowNode node;
+  rowNode* children[ROWTREE_FANOUT];
+} rowInner;
+
+static rowLeaf* newLeaf() {
+  rowLeaf* leaf = aligned_alloc(ROWTREE_LEAF_BYTES, ROWTREE_LEAF_BYTES);
+  check(leaf == NULL, "Fail to allocate rows");
+  memset(leaf, 0, sizeof(rowLeaf));
+  leaf->node.leaf = 1;
+  return leaf;
+}
+
+static rowLeaf* leafOf(const row* r) {
+  return (rowLeaf*)((uintptr_t)r & ~(uintptr_t)(ROWTREE_LEAF_BYTES - 1));
+}
+
+static long rowBytes(const row* r) {
+  return r->size + 1;
+}
+
+static rowInner* newInner() {
+  rowInner* inner = calloc(1, sizeof(rowInner));
+  check(inner == NULL, "Fail to allocate rows");
+  return inner;
+}
+
+static int childIndex(rowInner* p, rowNode* child) {
+  int k = 0;
+  while (p->children[k] != child)
+    k++;
+  return k;
+}
+
+static void recount(rowInner* p) {
+  p->node.count = 0;
+  p->node.bytes = 0;
+  for (int k = 0; k < p->node.n; k++) {
+    p->node.count += p->children[k]->count;
+    p->node.bytes += p->children[k]->bytes;
+  }
+}
+
+static void recountLeaf(rowLeaf* leaf) {
+  leaf->node.count = leaf->node.n;
+  leaf->node.bytes = 0;
+  for (int i = 0; i < leaf->node.n; i++)
+    leaf->node.bytes += rowBytes(&leaf->rows[i]);
+}
+
+/* rows were added/removed below node, or their bytes changed */
+static void addCount(rowNode* node, int rows, long bytes) {
+  for (; node; node = (rowNode*)node->parent) {
+    node->count += rows;
+    node->bytes += bytes;
+  }
+}
+
+/* Leaf holding position *i, which becomes the index inside that leaf. */
+static rowLeaf* findLeaf(rowTree* t, int* i) {
+  rowNode* node = t->root;
+  while (!node->leaf) {
+    rowInner* inner = (rowInner*)node;
+    int k;
+    for (k = 0; k < node->n - 1; k++) {
+      if (*i < inner->children[k]->count)
+        break;
+      *i -= inner->children[k]->count;
+    }
+    node = inner->children[k];
+  }
+  return (rowLeaf*)node;
+}
+
+/* Put child right after its new sibling, splitting full nodes on the way
+ * up. Moving children between siblings doesn't change the number of rows
+ * above them, only the split nodes are recounted. */
+static void insertChild(rowTree* t, rowNode* after, rowNode* child) {
+  rowInner* p = after->parent;
+  if (p == NULL) {
+    rowInner* root = newInner();
+    root->children[0] = after;
+    root->children[1] = child;
+    root->node.n = 2;
+    root->node.count = after->count + child->count;
+    root->node.bytes = after->bytes + child->bytes;
+    after->parent = child->parent = root;
+    t->root = &root->node;
+    return;
+  }
+
+  int pos = childIndex(p, after) + 1;
+  if (p->node.n == ROWTREE_FANOUT) {
+    /* Appending to a full node starts an empty sibling instead of halving
+     * it, so a tree built in order stays packed. */
+    rowInner* q = newInner();
+    int keep = pos == ROWTREE_FANOUT ? ROWTREE_FANOUT : ROWTREE_FANOUT / 2;
+    int moved = ROWTREE_FANOUT - keep;
+    memcpy(q->children, &p->children[keep], sizeof(rowNode*) * moved);
+    for (int k = 0; k < moved; k++)
+      q->children[k]->parent = q;
+    p->node.n = keep;
+    q->node.n = moved;
+
+    rowInner* target = p;
+    if (pos > keep || keep == ROWTREE_FANOUT) {
+      target = q;
+      pos -= keep;
+    }
+    memmove(&target->children[pos + 1], &target->children[pos],
+            sizeof(rowNode*) * (target->node.n - pos));
+    target->children[pos] = child;
+    child->parent = target;
+    target->node.n++;
+
+    recount(p);
+    recount(q);
+    insertChild(t, &p->node, &q->node);
+    return;
+  }
+
+  memmove(&p->children[pos + 1], &p->children[pos],
+          sizeof(rowNode*) * (p->node.n - pos));
+  p->children[pos] = child;
+  child->parent = p;
+  p->node.n++;
+}
+
+/* Unhook an empty node, and its parent if that ends up empty too. */
+static void removeNode(rowTree* t, rowNode* node) {
+  rowInner* p = node->parent;
+  if (p == NULL) {
+    t->root = NULL;
+    t->last = NULL;
+  } else {
+    int pos = childIndex(p, node);
+    memmove(&p->children[pos], &p->children[pos + 1],
+            sizeof(rowNode*) * (p->node.n - pos - 1));
+    p->node.n--;
+    if (p->node.n == 0)
+      removeNode(t, &p->node);
+  }
+  free(node);
+}
+
+static void removeLeaf(rowTree* t, rowLeaf* leaf) {
+  if (leaf->prev)
+    leaf->prev->next = leaf->next;
+  if (leaf->next)
+    leaf->next->prev = leaf->prev;
+  if (t->last == leaf)
+    t->last = leaf->prev;
+  removeNode(t, &leaf->node);
+}
+
+row* rowTreeGet(rowTree* t, int at) {
+  if (at < 0 || at >= t->count)
+    return NULL;
+  rowLeaf* leaf = findLeaf(t, &at);
+  return &leaf->rows[at];
+}
+
+/* Copy *r into the tree as row number at, returns where it ended up. */
+row* rowTreeInsert(rowTree* t, int at, const row* r) {
+  if (at < 0 || at > t->count)
+    return NULL;
+
+  rowLeaf* leaf;
+  int i = at;
+  if (t->root == NULL) {
+    leaf = newLeaf();
+    t->root = &leaf->node;
+    t->last = leaf;
+  } else if (at == t->count) {
+    leaf = t->last;
+    i = leaf->node.n;
+  } else {
+    leaf = findLeaf(t, &i);
+  }
+
+  if (leaf->node.n == LEAF_MAX) {
+    /* like inner nodes, appending never moves existing rows */
+    rowLeaf* next = newLeaf();
+    int keep = i == LEAF_MAX ? LEAF_MAX : LEAF_MAX / 2;
+    int moved = LEAF_MAX - keep;
+    memcpy(next->rows, &leaf->rows[keep], sizeof(row) * moved);
+    leaf->node.n = keep;
+    next->node.n = moved;
+    recountLeaf(leaf);
+    recountLeaf(next);
+
+    next->prev = leaf;
+    next->next = leaf->next;
+    if (leaf->next)
+      leaf->next->prev = next;
+    leaf->next = next;
+    if (t->last == leaf)
+      t->last = next;
+    insertChild(t, &leaf->node, &next->node);
+
+    if (i > keep || keep == LEAF_MAX) {
+      leaf = next;
+      i -= keep;
+    }
+  }
+
+  memmove(&leaf->rows[i + 1], &leaf->rows[i],
+          sizeof(row) * (leaf->node.n - i));
+  leaf->rows[i] = *r;
+  leaf->node.n++;
+  addCount(&leaf->node, 1, rowBytes(r));
+  t->count++;
+  return &leaf->rows[i];
+}
+
+/* Drop row number at from the tree, its contents are the caller's. */
+void rowTreeDelete(rowTree* t, int at) {
+  if (at < 0 || at >= t->count)
+    return;
+
+  int i = at;
+  rowLeaf* leaf = findLeaf(t, &i);
+  long bytes = rowBytes(&leaf->rows[i]);
+  memmove(&leaf->rows[i], &leaf->rows[i + 1],
+          sizeof(row) * (leaf->node.n - i - 1));
+  leaf->node.n--;
+  addCount(&leaf->node, -1, -bytes);
+  t->count--;
+
+  rowLeaf* next = leaf->next;
+  if (leaf->node.n == 0) {
+    removeLeaf(t, leaf);
+  } else if (leaf->node.n < LEAF_MAX / 4 && next &&
+             next->node.parent == leaf->node.parent &&
+             leaf->node.n + next->node.n <= LEAF_MAX) {
+    /* merge a sparse leaf with its sibling, their parent's count stays */
+    memcpy(&leaf->rows[leaf->node.n], next->rows, sizeof(row) * next->node.n);
+    leaf->node.n += next->node.n;
+    leaf->node.count = leaf->node.n;
+    leaf->node.bytes += next->node.bytes;
+    removeLeaf(t, next);
+  }
+
+  while (t->root && !t->root->leaf && t->root->n == 1) {
+    rowInner* root = (rowInner*)t->root;
+    t->root = root->children[0];
+    t->root->parent = NULL;
+    free(root);
+  }
+}
+
+static void freeNode(rowNode* node) {
+  if (!node->leaf) {
+    rowInner* inner = (rowInner*)node;
+    for (int k = 0; k < node->n; k++)
+      freeNode(inner->children[k]);
+  }
+  free(node);
+}
+
+/* Free the tree itself, not what the rows point to. */
+void rowTreeClear(rowTree* t) {
+  if (t->root)
+    freeNode(t->root);
+  *t = (rowTree)ROW_TREE_INIT;
+}
+
+row* rowTreeSeek(rowTree* t, int at, rowIter* it) {
+  if (at < 0 || at >= t->count) {
+    it->leaf = NULL;
+    return NULL;
+  }
+  it->leaf = findLeaf(t, &at);
+  it->i = at;
+  return &it->leaf->rows[at];
+}
+
+row* rowTreeNext(rowIter* it) {
+  if (it->leaf == NULL)
+    return NULL;
+  if (++it->i == it->leaf->node.n) {
+    it->leaf = it->leaf->next;
+    it->i = 0;
+    if (it->leaf == NULL)
+      return NULL;
+  }
+  return &it->leaf->rows[it->i];
+}
+
+row* rowTreePrev(rowIter* it) {
+  if (it->leaf == NULL)
+    return NULL;
+  if (--it->i < 0) {
+    it->leaf = it->leaf->prev;
+    if (it->leaf == NULL)
+      return NULL;
+    it->i = it->leaf->node.n - 1;
+  }
+  return &it->leaf->rows[it->i];
+}
+
+/* The text of row r, which is in a tree, grew by delta bytes. */
+void rowTreeResize(row* r, int delta) {
+  addCount(&leafOf(r)->node, 0, delta);
+}
+
+long rowTreeBytes(rowTree* t) {
+  return t->root ? t->root->bytes : 0;
+}
+
+/* Bytes before row number at, the total past the last row. */
+long rowTreeOffset(rowTree* t, int at) {
+  if (at >= t->count)
+    return rowTreeBytes(t);
+  if (at <= 0)
+    return 0;
+
+  long off = 0;
+  rowNode* node = t->root;
+  while (!node->leaf) {
+    rowInner* inner = (rowInner*)node;
+    int k;
+    for (k = 0; k < node->n - 1; k++) {
+      if (at < inner->children[k]->count)
+        break;
+      at -= inner->children[k]->count;
+      off += inner->children[k]->bytes;
+    }
+    node = inner->children[k];
+  }
+  rowLeaf* leaf = (rowLeaf*)node;
+  for (int i = 0; i < at; i++)
+    off += rowBytes(&leaf->rows[i]);
+  return off;
+}
+
+/* Number of the row whose text or newline holds byte off, the last row past
+ * the end. */
+int rowTreeRowAt(rowTree* t, long off) {
+  if (t->count == 0)
+    return -1;
+  if (off >= rowTreeBytes(t))
+    return t->count - 1;
+  if (off < 0)
+    off = 0;
+
+  int at = 0;
+  rowNode* node = t->root;
+  while (!node->leaf) {
+    rowInner* inner = (rowInner*)node;
+    int k;
+    for (k = 0; k < node->n - 1; k++) {
+      if (off < inner->children[k]->bytes)
+        break;
+      off -= inner->children[k]->bytes;
+      at += inner->children[k]->count;
+    }
+    node = inner->children[k];
+  }
+  rowLeaf* leaf = (rowLeaf*)node;
+  int i = 0;
+  while (i < leaf->node.n - 1 && off >= rowBytes(&leaf->rows[i]))
+    off -= rowBytes(&leaf->rows[i++]);
+  return at + i;
+}
@@ -0,0 +1,51 @@
+#ifndef __rowtree_h__
+#define __rowtree_h__
+
+/* bytes of one leaf, rows included, a power of two; children of one inner
+ * node */
+#define ROWTREE_LEAF_BYTES 4096
+#define ROWTREE_FANOUT 32
+
+struct row;
+struct rowNode;
+struct rowLeaf;
+
+/* B+ tree of rows keyed by position. Inner nodes keep the number of rows
+ * below them, so finding, inserting and deleting the n-th row are
+ * O(log n). Leaves hold the row structs themselves and are linked in
+ * order, so walking consecutive rows stays a linear scan.
+ *
+ * Every node also keeps the bytes below it, a newline per row included,
+ * so that a row's byte offset and the row at a byte offset are O(log n)
+ * too. Row sizes changed in place must be reported with rowTreeResize.
+ *
+ * Inserting or deleting a row moves its neighbours: row pointers are
+ * only valid until the next rowTreeInsert/rowTreeDelete. */
+typedef struct rowTree {
+  struct rowNode* root;
+  struct rowLeaf* last; /* appends go straight here */
+  int count;
+} rowTree;
+
+#define ROW_TREE_INIT \
+  { NULL, NULL, 0 }
+
+/* position of a row inside its leaf, for walking neighbours */
+typedef struct rowIter {
+  struct rowLeaf* leaf;
+  int i;
+} rowIter;
+
+struct row* rowTreeGet(rowTree*, int);
+struct row* rowTreeInsert(rowTree*, int, const struct row*);
+void rowTreeDelete(rowTree*, int);
+void rowTreeClear(rowTree*);
+struct row* rowTreeSeek(rowTree*, int, rowIter*);
+struct row* rowTreeNext(rowIter*);
+struct row* rowTreePrev(rowIter*);
+void rowTreeResize(struct row*, int);
+long rowTreeBytes(rowTree*);
+long rowTreeOffset(rowTree*, int);
+int rowTreeRowAt(rowTree*, long);
+
+#endif
@@ -0,0 +1,476 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dbg.h"
+#include "editor.h"
+#include "screen.h"
+#include "utf8.h"
+
+/* where the terminal's cursor is and which attribute it writes with while
+ * frame f is flushed, y == -1 when unknown */
+typedef struct pen {
+  screen* s;
+  const frame* f;
+  buffer* buf;
+  int y;
+  int x;
+  int attr;
+} pen;
+
+static const cell blank = {" ", 0};
+
+static int sameCell(cell a, cell b) {
+  return memcmp(&a, &b, sizeof(cell)) == 0;
+}
+
+/* the right half of a wide character */
+static int isTail(const cell* c) {
+  return c->ch[0] == '\0';
+}
+
+/* Columns up to the last cell of row that isn't a blank, the rest can be
+ * cleared with one erase. */
+static int rowEnd(const cell* row, int cols) {
+  while (cols > 0 && sameCell(row[cols - 1], blank))
+    cols--;
+  return cols;
+}
+
+static int formatInt(char* out, int n) {
+  char digits[12];
+  int len = 0;
+  do {
+    digits[len++] = '0' + n % 10;
+    n /= 10;
+  } while (n);
+  for (int i = 0; i < len; i++)
+    out[i] = digits[len - 1 - i];
+  return len;
+}
+
+static void penMove(pen* p, int y, int x) {
+  if (p->y == y && p->x == x)
+    return;
+  char tmp[32];
+  int len = 0;
+  tmp[len++] = '\x1b';
+  tmp[len++] = '[';
+  len += formatInt(&tmp[len], y + 1);
+  tmp[len++] = ';';
+  len += formatInt(&tmp[len], x + 1);
+  tmp[len++] = 'H';
+  bufferAppend(p->buf, tmp, len);
+  p->y = y;
+  p->x = x;
+}
+
+static void penAttr(pen* p, int attr) {
+  if (p->attr == attr)
+    return;
+  char tmp[16];
+  int len = 0;
+  tmp[len++] = '\x1b';
+  tmp[len++] = '[';
+  tmp[len++] = '0';
+  if (attr & CELL_REVERSE) {
+    tmp[len++] = ';';
+    tmp[len++] = '7';
+  }
+  if (attr & ~CELL_REVERSE) {
+    tmp[len++] = ';';
+    len += formatInt(&tmp[len], attr & ~CELL_REVERSE);
+  }
+  tmp[len++] = 'm';
+  bufferAppend(p->buf, tmp, len);
+  p->attr = attr;
+}
+
+/* Write n cells from the cursor, one copy per run of equal attribute. */
+static void penPut(pen* p, const cell* c, int n) {
+  int i = 0;
+  while (i < n) {
+    penAttr(p, c[i].attr);
+    int j = i;
+    while (j < n && c[j].attr == p->attr)
+      j++;
+    bufferReserve(p->buf, (j - i) * CELL_BYTES);
+    char* out = &p->buf->start[p->buf->size];
+    for (int k = i; k < j; k++) {
+      /* a tail writes nothing, its wide character took both columns */
+      for (int b = 0; b < CELL_BYTES && c[k].ch[b]; b++)
+        *out++ = c[k].ch[b];
+    }
+    p->buf->size = out - p->buf->start;
+    i = j;
+  }
+  p->x += n;
+  /* past the last column the terminal waits to wrap, don't rely on it */
+  if (p->x >= p->f->cols)
+    p->y = -1;
+}
+
+/* erase from the cursor to the end of its row */
+static void penErase(pen* p) {
+  penAttr(p, 0);
+  bufferAppend(p->buf, "\x1b[K", 3);
+}
+
+static void repaintRow(pen* p, int y) {
+  const cell* row = &p->f->cells[y * p->f->cols];
+  int end = rowEnd(row, p->f->cols);
+  penMove(p, y, 0);
+  penPut(p, row, end);
+  if (end < p->f->cols)
+    penErase(p);
+}
+
+static void penScroll(pen* p) {
+  const frame* s = p->f;
+  char tmp[48];
+  int len = 0;
+  /* DECSTBM to the moved rows, SU or SD, then back to the whole screen */
+  tmp[len++] = '\x1b';
+  tmp[len++] = '[';
+  len += formatInt(&tmp[len], s->scrolltop + 1);
+  tmp[len++] = ';';
+  len += formatInt(&tmp[len], s->scrollbottom);
+  tmp[len++] = 'r';
+  tmp[len++] = '\x1b';
+  tmp[len++] = '[';
+  len += formatInt(&tmp[len], abs(s->scrolled));
+  tmp[len++] = s->scrolled > 0 ? 'S' : 'T';
+  memcpy(&tmp[len], "\x1b[r", 3);
+  len += 3;
+  bufferAppend(p->buf, tmp, len);
+  /* setting the margins homes the cursor */
+  p->y = -1;
+}
+
+/* Emit the changed spans of row y, joining those only a few unchanged
+ * cells apart. */
+static void diffRow(pen* p, int y) {
+  int cols = p->f->cols;
+  const cell* row = &p->f->cells[y * cols];
+  const cell* old = &p->s->shown[y * cols];
+  if (memcmp(row, old, sizeof(cell) * cols) == 0)
+    return;
+
+  int end = rowEnd(row, cols);
+  int x = 0;
+  while (x < cols) {
+    if (sameCell(row[x], old[x])) {
+      x++;
+      continue;
+    }
+    int last = x;
+    for (int k = x + 1; k < cols && k - last <= SCREEN_GAP; k++) {
+      if (!sameCell(row[k], old[k]))
+        last = k;
+    }
+    /* a wide character is written whole, from its left half */
+    if (x > 0 && isTail(&row[x]))
+      x--;
+    if (last + 1 < cols && isTail(&row[last + 1]))
+      last++;
+    penMove(p, y, x);
+    if (last >= end) {
+      /* the rest of the row is blank */
+      if (x < end)
+        penPut(p, &row[x], end - x);
+      penErase(p);
+      return;
+    }
+    penPut(p, &row[x], last + 1 - x);
+    x = last + 1;
+  }
+}
+
+/* The scroll of f applied to shown, as the terminal will do it. Returns
+ * whether it could be, otherwise all of f has to be repainted. */
+static int shownScroll(screen* s, const frame* f) {
+  int top = f->scrolltop;
+  int bottom = f->scrollbottom;
+  int n = f->scrolled;
+  int height = bottom - top;
+  if (top < 0 || bottom > s->rows || n >= height || -n >= height)
+    return 0;
+
+  int cols = s->cols;
+  int kept = height - abs(n);
+  cell* from = &s->shown[(top + (n > 0 ? n : 0)) * cols];
+  cell* to = &s->shown[(top + (n > 0 ? 0 : -n)) * cols];
+  memmove(to, from, sizeof(cell) * kept * cols);
+  cell* exposed = &s->shown[(n > 0 ? bottom - n : top) * cols];
+  for (int i = 0; i < abs(n) * cols; i++)
+    exposed[i] = blank;
+  return 1;
+}
+
+/* Append to buf what turns the last frame sent into f. A diff that costs
+ * more than the cells of a whole frame is dropped for a repaint. The
+ * cursor is hidden meanwhile, then f's cursor bytes put it in place. */
+static void screenFlush(screen* s, frame* f, buffer* buf) {
+  if (s->rows != f->rows || s->cols != f->cols || s->shown == NULL) {
+    s->shown = realloc(s->shown, sizeof(cell) * (f->rows * f->cols + 1));
+    check(s->shown == NULL, "Fail to allocate screen");
+    s->rows = f->rows;
+    s->cols = f->cols;
+    s->valid = 0;
+  }
+  if (f->repaint)
+    s->valid = 0;
+
+  bufferAppend(buf, "\x1b[?25l", 6);
+  int start = buf->size;
+  pen p = {s, f, buf, -1, -1, 0};
+  if (s->valid) {
+    if (f->scrolled) {
+      if (shownScroll(s, f))
+        penScroll(&p);
+      else
+        s->valid = 0;
+    }
+  }
+  if (s->valid) {
+    for (int y = 0; y < f->rows; y++) {
+      diffRow(&p, y);
+      if (buf->size - start > f->rows * f->cols) {
+        buf->size = start;
+        s->valid = 0;
+        break;
+      }
+    }
+  }
+  if (!s->valid) {
+    /* cursor and attribute are unknown, or left behind by a dropped diff */
+    p.y = -1;
+    p.attr = -1;
+    for (int y = 0; y < f->rows; y++)
+      repaintRow(&p, y);
+  }
+  penAttr(&p, 0);
+  bufferAppend(buf, f->cursor, f->cursorlen);
+
+  /* same size, trade the buffers */
+  cell* shown = s->shown;
+  s->shown = f->cells;
+  f->cells = shown;
+  s->valid = 1;
+}
+
+/* Wait until the terminal takes more output, it's behind otherwise. */
+static void screenWaitRoom(screen* s) {
+  struct pollfd fd = {s->fd, POLLOUT, 0};
+  while (poll(&fd, 1, -1) == -1 && errno == EINTR) {
+  }
+}
+
+static void screenWrite(screen* s, const char* out, int len) {
+  while (len > 0) {
+    ssize_t n = write(s->fd, out, len);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1 && errno == EAGAIN) {
+      /* a frame started has to be finished, newer ones wait meanwhile */
+      screenWaitRoom(s);
+      continue;
+    }
+    /* the terminal is gone, nothing to do about it */
+    if (n <= 0)
+      return;
+    out += n;
+    len -= n;
+  }
+}
+
+/* The writer thread: sends the newest frame submitted, one at a time. */
+static void* screenRun(void* arg) {
+  screen* s = arg;
+  buffer buf = BUFFER_INIT;
+  while (1) {
+    pthread_mutex_lock(&s->lock);
+    while (!s->ready)
+      pthread_cond_wait(&s->cond, &s->lock);
+    s->busy = 1;
+    pthread_mutex_unlock(&s->lock);
+
+    /* while the terminal is behind, frames keep replacing each other and
+     * the one taken once it catches up is the newest */
+    screenWaitRoom(s);
+
+    pthread_mutex_lock(&s->lock);
+    frame taken = s->pending;
+    s->pending = s->out;
+    s->out = taken;
+    s->ready = 0;
+    int synchronized = s->synchronized;
+    pthread_mutex_unlock(&s->lock);
+
+    buf.size = 0;
+    /* the terminal shows the frame once it's all there, not row by row */
+    if (synchronized)
+      bufferAppend(&buf, "\x1b[?2026h", 8);
+    screenFlush(s, &s->out, &buf);
+    if (synchronized)
+      bufferAppend(&buf, "\x1b[?2026l", 8);
+    screenWrite(s, buf.start, buf.size);
+
+    pthread_mutex_lock(&s->lock);
+    s->busy = 0;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+  }
+  return NULL;
+}
+
+/* Set up s with nothing shown yet and start its writer on fd. */
+void screenStart(screen* s, int fd) {
+  memset(s, 0, sizeof(*s));
+  /* a file of its own to be non-blocking, setting it on fd would change
+   * the terminal's input too */
+  char* tty = ttyname(fd);
+  s->fd = tty ? open(tty, O_WRONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC) : -1;
+  if (s->fd == -1)
+    s->fd = fd;
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->cond, NULL);
+  check(pthread_create(&s->thread, NULL, screenRun, s) != 0,
+        "Fail to start screen writer");
+}
+
+void screenResize(screen* s, int rows, int cols) {
+  frame* f = &s->draw;
+  if (f->rows == rows && f->cols == cols && f->cells)
+    return;
+  size_t size = sizeof(cell) * (rows > 0 && cols > 0 ? rows * cols : 1);
+  f->cells = realloc(f->cells, size);
+  check(f->cells == NULL, "Fail to allocate screen");
+  f->rows = rows;
+  f->cols = cols;
+}
+
+/* The terminal no longer shows the last frame, repaint it all next time. */
+void screenInvalidate(screen* s) {
+  s->draw.repaint = 1;
+}
+
+/* The rows [top, bottom) of the frame show what the last one had n rows
+ * further down (up for n < 0), e.g. the text was scrolled. The writer has
+ * the terminal move them and only draws the rows that came into view. */
+void screenScroll(screen* s, int top, int bottom, int n) {
+  frame* f = &s->draw;
+  if (n == 0)
+    return;
+  if (f->scrolled == 0) {
+    f->scrolltop = top;
+    f->scrollbottom = bottom;
+    f->scrolled = n;
+  } else if (f->scrolltop == top && f->scrollbottom == bottom) {
+    f->scrolled += n;
+  } else {
+    /* two different moves, repaint */
+    f->repaint = 1;
+  }
+}
+
+void screenClear(screen* s) {
+  int n = s->draw.rows * s->draw.cols;
+  for (int i = 0; i < n; i++)
+    s->draw.cells[i] = blank;
+}
+
+/* Put the len bytes of UTF-8 text at row y, column x, clipped to the
+ * screen: a byte per column as long as they're ASCII. Returns the column
+ * after them. */
+int screenPut(screen* s, int y, int x, const char* text, int len, int attr) {
+  frame* f = &s->draw;
+  if (y < 0 || y >= f->rows || x >= f->cols)
+    return x;
+  cell* c = &f->cells[y * f->cols];
+  int i = 0;
+  while (i < len && x < f->cols) {
+    int k = utf8Span(&text[i], len - i);
+    if (k > f->cols - x)
+      k = f->cols - x;
+    for (int end = i + k; i < end; i++, x++)
+      c[x] = (cell){{text[i]}, attr};
+    if (i == len || x == f->cols)
+      break;
+
+    int cp;
+    int n = utf8Char(&text[i], len - i, &cp);
+    int width = utf8Width(cp);
+    if (cp < 0) {
+      c[x++] = (cell){"?", attr};
+    } else if (width == 0) {
+      /* drawn on the character before, if there's room left in its cell */
+      if (x > 0) {
+        cell* base = isTail(&c[x - 1]) ? &c[x - 2] : &c[x - 1];
+        int used = strnlen(base->ch, CELL_BYTES);
+        if (used + n <= CELL_BYTES)
+          memcpy(&base->ch[used], &text[i], n);
+      }
+    } else if (width == 2 && x + 1 == f->cols) {
+      /* no room for its right half */
+      c[x++] = (cell){" ", attr};
+    } else {
+      c[x] = (cell){"", attr};
+      memcpy(c[x].ch, &text[i], n);
+      x++;
+      if (width == 2)
+        c[x++] = (cell){"", attr};
+    }
+    i += n;
+  }
+  return x;
+}
+
+/* Bytes that place the cursor once the frame is sent. */
+void screenCursor(screen* s, const char* text, int len) {
+  if (len > FRAME_CURSOR_SIZE)
+    len = FRAME_CURSOR_SIZE;
+  memcpy(s->draw.cursor, text, len);
+  s->draw.cursorlen = len;
+}
+
+/* Whether the terminal has synchronized output, see querySynchronizedOutput.
+ * Frames are written plainly until told. */
+void screenSynchronized(screen* s, int on) {
+  pthread_mutex_lock(&s->lock);
+  s->synchronized = on;
+  pthread_mutex_unlock(&s->lock);
+}
+
+/* Hand the drawn frame to the writer. One it hasn't taken yet is dropped,
+ * its scroll and repaint carried over into this one. */
+void screenSubmit(screen* s) {
+  pthread_mutex_lock(&s->lock);
+  frame* f = &s->draw;
+  if (s->ready) {
+    frame* stale = &s->pending;
+    if (stale->scrolled)
+      screenScroll(s, stale->scrolltop, stale->scrollbottom, stale->scrolled);
+    f->repaint |= stale->repaint;
+  }
+  frame drawn = *f;
+  *f = s->pending;
+  s->pending = drawn;
+  s->ready = 1;
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->lock);
+
+  f->repaint = 0;
+  f->scrolled = 0;
+}
+
+/* Wait until every frame submitted is on the terminal. */
+void screenSync(screen* s) {
+  pthread_mutex_lock(&s->lock);
+  while (s->ready || s->busy)
+    pthread_cond_wait(&s->cond, &s->lock);
+  pthread_mutex_unlock(&s->lock);
+}
@@ -0,0 +1,75 @@
+#ifndef __screen_h__
+#define __screen_h__
+
+#include <pthread.h>
+
+/* attribute of a cell: an SGR foreground color (30-37), 0 for the default
+ * one, or'ed with the flags below */
+#define CELL_REVERSE 0x80
+/* bytes of a character and its marks kept per cell, so that a cell is 8 */
+#define CELL_BYTES 7
+/* unchanged cells worth rewriting instead of moving the cursor over them */
+#define SCREEN_GAP 6
+/* bytes sent after a frame's cells, to place and shape the cursor */
+#define FRAME_CURSOR_SIZE 32
+
+/* A column on the terminal: the UTF-8 of the character shown there and the
+ * marks drawn on it, as much of it as fits, '\0' padded. A wide character
+ * is followed by a cell whose ch[0] is '\0', taken by its right half. */
+typedef struct cell {
+  char ch[CELL_BYTES];
+  unsigned char attr;
+} cell;
+
+/* A drawn frame, as handed from the editor thread to the writer. */
+typedef struct frame {
+  cell* cells;
+  int rows;
+  int cols;
+  int repaint; /* the terminal may not show the frames sent before */
+  /* rows [scrolltop, scrollbottom) show what the frame before had scrolled
+   * rows further down, see screenScroll */
+  int scrolltop;
+  int scrollbottom;
+  int scrolled;
+  char cursor[FRAME_CURSOR_SIZE];
+  int cursorlen;
+} frame;
+
+/* Cells on the terminal. The editor thread draws a frame into cells and
+ * submits it; a writer thread compares it with the last one sent and
+ * emits only the spans that changed, with cursor moves in between. A
+ * frame not taken by the writer yet is replaced by a newer one, and the
+ * writer only takes one once the terminal has room for it, so a slow
+ * terminal only ever gets the latest. Whatever else touches the terminal
+ * has to call screenSync first, and screenInvalidate if it changes what's
+ * shown. */
+typedef struct screen {
+  frame draw;    /* editor thread: being drawn */
+  frame pending; /* submitted, waiting for the writer if ready */
+  frame out;     /* writer thread: being written */
+  cell* shown;   /* writer thread: last frame sent to the terminal */
+  int rows;      /* of shown */
+  int cols;
+  int valid;        /* shown is what the terminal displays */
+  int fd;           /* the terminal, non-blocking if it could be */
+  int synchronized; /* frames are sent as DEC 2026 synchronized updates */
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond; /* signalled when ready or busy changes */
+  int ready;           /* pending holds a frame */
+  int busy;            /* the writer is sending out */
+} screen;
+
+void screenStart(screen*, int);
+void screenResize(screen*, int, int);
+void screenInvalidate(screen*);
+void screenClear(screen*);
+void screenScroll(screen*, int, int, int);
+int screenPut(screen*, int, int, const char*, int, int);
+void screenCursor(screen*, const char*, int);
+void screenSynchronized(screen*, int);
+void screenSubmit(screen*);
+void screenSync(screen*);
+
+#endif
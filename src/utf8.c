@@ -0,0 +1,415 @@
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#include "utf8.h"
+
+#define RUN(cp, width) ((unsigned int)(cp) << 2 | (width))
+
+/* Where the width changes: each entry starts a run of code points of its
+ * width, which lasts until the next one, from U+0300 on. Widths are those
+ * of Unicode 15 as wcwidth has them, which is what terminals go by: 2 for
+ * East Asian wide and fullwidth characters, 0 for combining marks and
+ * format characters, 1 for the rest and for what's unassigned. */
+static const unsigned int widthRuns[] = {
+  RUN(0x300, 0), RUN(0x370, 1), RUN(0x483, 0), RUN(0x48a, 1), RUN(0x591, 0),
+  RUN(0x5be, 1), RUN(0x5bf, 0), RUN(0x5c0, 1), RUN(0x5c1, 0), RUN(0x5c3, 1),
+  RUN(0x5c4, 0), RUN(0x5c6, 1), RUN(0x5c7, 0), RUN(0x5c8, 1), RUN(0x610, 0),
+  RUN(0x61b, 1), RUN(0x61c, 0), RUN(0x61d, 1), RUN(0x64b, 0), RUN(0x660, 1),
+  RUN(0x670, 0), RUN(0x671, 1), RUN(0x6d6, 0), RUN(0x6dd, 1), RUN(0x6df, 0),
+  RUN(0x6e5, 1), RUN(0x6e7, 0), RUN(0x6e9, 1), RUN(0x6ea, 0), RUN(0x6ee, 1),
+  RUN(0x711, 0), RUN(0x712, 1), RUN(0x730, 0), RUN(0x74b, 1), RUN(0x7a6, 0),
+  RUN(0x7b1, 1), RUN(0x7eb, 0), RUN(0x7f4, 1), RUN(0x7fd, 0), RUN(0x7fe, 1),
+  RUN(0x816, 0), RUN(0x81a, 1), RUN(0x81b, 0), RUN(0x824, 1), RUN(0x825, 0),
+  RUN(0x828, 1), RUN(0x829, 0), RUN(0x82e, 1), RUN(0x859, 0), RUN(0x85c, 1),
+  RUN(0x898, 0), RUN(0x8a0, 1), RUN(0x8ca, 0), RUN(0x8e2, 1), RUN(0x8e3, 0),
+  RUN(0x903, 1), RUN(0x93a, 0), RUN(0x93b, 1), RUN(0x93c, 0), RUN(0x93d, 1),
+  RUN(0x941, 0), RUN(0x949, 1), RUN(0x94d, 0), RUN(0x94e, 1), RUN(0x951, 0),
+  RUN(0x958, 1), RUN(0x962, 0), RUN(0x964, 1), RUN(0x981, 0), RUN(0x982, 1),
+  RUN(0x9bc, 0), RUN(0x9bd, 1), RUN(0x9c1, 0), RUN(0x9c5, 1), RUN(0x9cd, 0),
+  RUN(0x9ce, 1), RUN(0x9e2, 0), RUN(0x9e4, 1), RUN(0x9fe, 0), RUN(0x9ff, 1),
+  RUN(0xa01, 0), RUN(0xa03, 1), RUN(0xa3c, 0), RUN(0xa3d, 1), RUN(0xa41, 0),
+  RUN(0xa43, 1), RUN(0xa47, 0), RUN(0xa49, 1), RUN(0xa4b, 0), RUN(0xa4e, 1),
+  RUN(0xa51, 0), RUN(0xa52, 1), RUN(0xa70, 0), RUN(0xa72, 1), RUN(0xa75, 0),
+  RUN(0xa76, 1), RUN(0xa81, 0), RUN(0xa83, 1), RUN(0xabc, 0), RUN(0xabd, 1),
+  RUN(0xac1, 0), RUN(0xac6, 1), RUN(0xac7, 0), RUN(0xac9, 1), RUN(0xacd, 0),
+  RUN(0xace, 1), RUN(0xae2, 0), RUN(0xae4, 1), RUN(0xafa, 0), RUN(0xb00, 1),
+  RUN(0xb01, 0), RUN(0xb02, 1), RUN(0xb3c, 0), RUN(0xb3d, 1), RUN(0xb3f, 0),
+  RUN(0xb40, 1), RUN(0xb41, 0), RUN(0xb45, 1), RUN(0xb4d, 0), RUN(0xb4e, 1),
+  RUN(0xb55, 0), RUN(0xb57, 1), RUN(0xb62, 0), RUN(0xb64, 1), RUN(0xb82, 0),
+  RUN(0xb83, 1), RUN(0xbc0, 0), RUN(0xbc1, 1), RUN(0xbcd, 0), RUN(0xbce, 1),
+  RUN(0xc00, 0), RUN(0xc01, 1), RUN(0xc04, 0), RUN(0xc05, 1), RUN(0xc3c, 0),
+  RUN(0xc3d, 1), RUN(0xc3e, 0), RUN(0xc41, 1), RUN(0xc46, 0), RUN(0xc49, 1),
+  RUN(0xc4a, 0), RUN(0xc4e, 1), RUN(0xc55, 0), RUN(0xc57, 1), RUN(0xc62, 0),
+  RUN(0xc64, 1), RUN(0xc81, 0), RUN(0xc82, 1), RUN(0xcbc, 0), RUN(0xcbd, 1),
+  RUN(0xcbf, 0), RUN(0xcc0, 1), RUN(0xcc6, 0), RUN(0xcc7, 1), RUN(0xccc, 0),
+  RUN(0xcce, 1), RUN(0xce2, 0), RUN(0xce4, 1), RUN(0xd00, 0), RUN(0xd02, 1),
+  RUN(0xd3b, 0), RUN(0xd3d, 1), RUN(0xd41, 0), RUN(0xd45, 1), RUN(0xd4d, 0),
+  RUN(0xd4e, 1), RUN(0xd62, 0), RUN(0xd64, 1), RUN(0xd81, 0), RUN(0xd82, 1),
+  RUN(0xdca, 0), RUN(0xdcb, 1), RUN(0xdd2, 0), RUN(0xdd5, 1), RUN(0xdd6, 0),
+  RUN(0xdd7, 1), RUN(0xe31, 0), RUN(0xe32, 1), RUN(0xe34, 0), RUN(0xe3b, 1),
+  RUN(0xe47, 0), RUN(0xe4f, 1), RUN(0xeb1, 0), RUN(0xeb2, 1), RUN(0xeb4, 0),
+  RUN(0xebd, 1), RUN(0xec8, 0), RUN(0xece, 1), RUN(0xf18, 0), RUN(0xf1a, 1),
+  RUN(0xf35, 0), RUN(0xf36, 1), RUN(0xf37, 0), RUN(0xf38, 1), RUN(0xf39, 0),
+  RUN(0xf3a, 1), RUN(0xf71, 0), RUN(0xf7f, 1), RUN(0xf80, 0), RUN(0xf85, 1),
+  RUN(0xf86, 0), RUN(0xf88, 1), RUN(0xf8d, 0), RUN(0xf98, 1), RUN(0xf99, 0),
+  RUN(0xfbd, 1), RUN(0xfc6, 0), RUN(0xfc7, 1), RUN(0x102d, 0), RUN(0x1031, 1),
+  RUN(0x1032, 0), RUN(0x1038, 1), RUN(0x1039, 0), RUN(0x103b, 1),
+  RUN(0x103d, 0), RUN(0x103f, 1), RUN(0x1058, 0), RUN(0x105a, 1),
+  RUN(0x105e, 0), RUN(0x1061, 1), RUN(0x1071, 0), RUN(0x1075, 1),
+  RUN(0x1082, 0), RUN(0x1083, 1), RUN(0x1085, 0), RUN(0x1087, 1),
+  RUN(0x108d, 0), RUN(0x108e, 1), RUN(0x109d, 0), RUN(0x109e, 1),
+  RUN(0x1100, 2), RUN(0x1160, 0), RUN(0x1200, 1), RUN(0x135d, 0),
+  RUN(0x1360, 1), RUN(0x1712, 0), RUN(0x1715, 1), RUN(0x1732, 0),
+  RUN(0x1734, 1), RUN(0x1752, 0), RUN(0x1754, 1), RUN(0x1772, 0),
+  RUN(0x1774, 1), RUN(0x17b4, 0), RUN(0x17b6, 1), RUN(0x17b7, 0),
+  RUN(0x17be, 1), RUN(0x17c6, 0), RUN(0x17c7, 1), RUN(0x17c9, 0),
+  RUN(0x17d4, 1), RUN(0x17dd, 0), RUN(0x17de, 1), RUN(0x180b, 0),
+  RUN(0x1810, 1), RUN(0x1885, 0), RUN(0x1887, 1), RUN(0x18a9, 0),
+  RUN(0x18aa, 1), RUN(0x1920, 0), RUN(0x1923, 1), RUN(0x1927, 0),
+  RUN(0x1929, 1), RUN(0x1932, 0), RUN(0x1933, 1), RUN(0x1939, 0),
+  RUN(0x193c, 1), RUN(0x1a17, 0), RUN(0x1a19, 1), RUN(0x1a1b, 0),
+  RUN(0x1a1c, 1), RUN(0x1a56, 0), RUN(0x1a57, 1), RUN(0x1a58, 0),
+  RUN(0x1a5f, 1), RUN(0x1a60, 0), RUN(0x1a61, 1), RUN(0x1a62, 0),
+  RUN(0x1a63, 1), RUN(0x1a65, 0), RUN(0x1a6d, 1), RUN(0x1a73, 0),
+  RUN(0x1a7d, 1), RUN(0x1a7f, 0), RUN(0x1a80, 1), RUN(0x1ab0, 0),
+  RUN(0x1acf, 1), RUN(0x1b00, 0), RUN(0x1b04, 1), RUN(0x1b34, 0),
+  RUN(0x1b35, 1), RUN(0x1b36, 0), RUN(0x1b3b, 1), RUN(0x1b3c, 0),
+  RUN(0x1b3d, 1), RUN(0x1b42, 0), RUN(0x1b43, 1), RUN(0x1b6b, 0),
+  RUN(0x1b74, 1), RUN(0x1b80, 0), RUN(0x1b82, 1), RUN(0x1ba2, 0),
+  RUN(0x1ba6, 1), RUN(0x1ba8, 0), RUN(0x1baa, 1), RUN(0x1bab, 0),
+  RUN(0x1bae, 1), RUN(0x1be6, 0), RUN(0x1be7, 1), RUN(0x1be8, 0),
+  RUN(0x1bea, 1), RUN(0x1bed, 0), RUN(0x1bee, 1), RUN(0x1bef, 0),
+  RUN(0x1bf2, 1), RUN(0x1c2c, 0), RUN(0x1c34, 1), RUN(0x1c36, 0),
+  RUN(0x1c38, 1), RUN(0x1cd0, 0), RUN(0x1cd3, 1), RUN(0x1cd4, 0),
+  RUN(0x1ce1, 1), RUN(0x1ce2, 0), RUN(0x1ce9, 1), RUN(0x1ced, 0),
+  RUN(0x1cee, 1), RUN(0x1cf4, 0), RUN(0x1cf5, 1), RUN(0x1cf8, 0),
+  RUN(0x1cfa, 1), RUN(0x1dc0, 0), RUN(0x1e00, 1), RUN(0x200b, 0),
+  RUN(0x2010, 1), RUN(0x202a, 0), RUN(0x202f, 1), RUN(0x2060, 0),
+  RUN(0x2065, 1), RUN(0x2066, 0), RUN(0x2070, 1), RUN(0x20d0, 0),
+  RUN(0x20f1, 1), RUN(0x231a, 2), RUN(0x231c, 1), RUN(0x2329, 2),
+  RUN(0x232b, 1), RUN(0x23e9, 2), RUN(0x23ed, 1), RUN(0x23f0, 2),
+  RUN(0x23f1, 1), RUN(0x23f3, 2), RUN(0x23f4, 1), RUN(0x25fd, 2),
+  RUN(0x25ff, 1), RUN(0x2614, 2), RUN(0x2616, 1), RUN(0x2648, 2),
+  RUN(0x2654, 1), RUN(0x267f, 2), RUN(0x2680, 1), RUN(0x2693, 2),
+  RUN(0x2694, 1), RUN(0x26a1, 2), RUN(0x26a2, 1), RUN(0x26aa, 2),
+  RUN(0x26ac, 1), RUN(0x26bd, 2), RUN(0x26bf, 1), RUN(0x26c4, 2),
+  RUN(0x26c6, 1), RUN(0x26ce, 2), RUN(0x26cf, 1), RUN(0x26d4, 2),
+  RUN(0x26d5, 1), RUN(0x26ea, 2), RUN(0x26eb, 1), RUN(0x26f2, 2),
+  RUN(0x26f4, 1), RUN(0x26f5, 2), RUN(0x26f6, 1), RUN(0x26fa, 2),
+  RUN(0x26fb, 1), RUN(0x26fd, 2), RUN(0x26fe, 1), RUN(0x2705, 2),
+  RUN(0x2706, 1), RUN(0x270a, 2), RUN(0x270c, 1), RUN(0x2728, 2),
+  RUN(0x2729, 1), RUN(0x274c, 2), RUN(0x274d, 1), RUN(0x274e, 2),
+  RUN(0x274f, 1), RUN(0x2753, 2), RUN(0x2756, 1), RUN(0x2757, 2),
+  RUN(0x2758, 1), RUN(0x2795, 2), RUN(0x2798, 1), RUN(0x27b0, 2),
+  RUN(0x27b1, 1), RUN(0x27bf, 2), RUN(0x27c0, 1), RUN(0x2b1b, 2),
+  RUN(0x2b1d, 1), RUN(0x2b50, 2), RUN(0x2b51, 1), RUN(0x2b55, 2),
+  RUN(0x2b56, 1), RUN(0x2cef, 0), RUN(0x2cf2, 1), RUN(0x2d7f, 0),
+  RUN(0x2d80, 1), RUN(0x2de0, 0), RUN(0x2e00, 1), RUN(0x2e80, 2),
+  RUN(0x2e9a, 1), RUN(0x2e9b, 2), RUN(0x2ef4, 1), RUN(0x2f00, 2),
+  RUN(0x2fd6, 1), RUN(0x2ff0, 2), RUN(0x2ffc, 1), RUN(0x3000, 2),
+  RUN(0x302a, 0), RUN(0x302e, 2), RUN(0x303f, 1), RUN(0x3041, 2),
+  RUN(0x3097, 1), RUN(0x3099, 0), RUN(0x309b, 2), RUN(0x3100, 1),
+  RUN(0x3105, 2), RUN(0x3130, 1), RUN(0x3131, 2), RUN(0x318f, 1),
+  RUN(0x3190, 2), RUN(0x31e4, 1), RUN(0x31f0, 2), RUN(0x321f, 1),
+  RUN(0x3220, 2), RUN(0xa48d, 1), RUN(0xa490, 2), RUN(0xa4c7, 1),
+  RUN(0xa66f, 0), RUN(0xa673, 1), RUN(0xa674, 0), RUN(0xa67e, 1),
+  RUN(0xa69e, 0), RUN(0xa6a0, 1), RUN(0xa6f0, 0), RUN(0xa6f2, 1),
+  RUN(0xa802, 0), RUN(0xa803, 1), RUN(0xa806, 0), RUN(0xa807, 1),
+  RUN(0xa80b, 0), RUN(0xa80c, 1), RUN(0xa825, 0), RUN(0xa827, 1),
+  RUN(0xa82c, 0), RUN(0xa82d, 1), RUN(0xa8c4, 0), RUN(0xa8c6, 1),
+  RUN(0xa8e0, 0), RUN(0xa8f2, 1), RUN(0xa8ff, 0), RUN(0xa900, 1),
+  RUN(0xa926, 0), RUN(0xa92e, 1), RUN(0xa947, 0), RUN(0xa952, 1),
+  RUN(0xa960, 2), RUN(0xa97d, 1), RUN(0xa980, 0), RUN(0xa983, 1),
+  RUN(0xa9b3, 0), RUN(0xa9b4, 1), RUN(0xa9b6, 0), RUN(0xa9ba, 1),
+  RUN(0xa9bc, 0), RUN(0xa9be, 1), RUN(0xa9e5, 0), RUN(0xa9e6, 1),
+  RUN(0xaa29, 0), RUN(0xaa2f, 1), RUN(0xaa31, 0), RUN(0xaa33, 1),
+  RUN(0xaa35, 0), RUN(0xaa37, 1), RUN(0xaa43, 0), RUN(0xaa44, 1),
+  RUN(0xaa4c, 0), RUN(0xaa4d, 1), RUN(0xaa7c, 0), RUN(0xaa7d, 1),
+  RUN(0xaab0, 0), RUN(0xaab1, 1), RUN(0xaab2, 0), RUN(0xaab5, 1),
+  RUN(0xaab7, 0), RUN(0xaab9, 1), RUN(0xaabe, 0), RUN(0xaac0, 1),
+  RUN(0xaac1, 0), RUN(0xaac2, 1), RUN(0xaaec, 0), RUN(0xaaee, 1),
+  RUN(0xaaf6, 0), RUN(0xaaf7, 1), RUN(0xabe5, 0), RUN(0xabe6, 1),
+  RUN(0xabe8, 0), RUN(0xabe9, 1), RUN(0xabed, 0), RUN(0xabee, 1),
+  RUN(0xac00, 2), RUN(0xd7a4, 1), RUN(0xd7b0, 0), RUN(0xd7c7, 1),
+  RUN(0xd7cb, 0), RUN(0xd7fc, 1), RUN(0xf900, 2), RUN(0xfa6e, 1),
+  RUN(0xfa70, 2), RUN(0xfada, 1), RUN(0xfb1e, 0), RUN(0xfb1f, 1),
+  RUN(0xfe00, 0), RUN(0xfe10, 2), RUN(0xfe1a, 1), RUN(0xfe20, 0),
+  RUN(0xfe30, 2), RUN(0xfe53, 1), RUN(0xfe54, 2), RUN(0xfe67, 1),
+  RUN(0xfe68, 2), RUN(0xfe6c, 1), RUN(0xfeff, 0), RUN(0xff00, 1),
+  RUN(0xff01, 2), RUN(0xff61, 1), RUN(0xffe0, 2), RUN(0xffe7, 1),
+  RUN(0xfff9, 0), RUN(0xfffc, 1), RUN(0x101fd, 0), RUN(0x101fe, 1),
+  RUN(0x102e0, 0), RUN(0x102e1, 1), RUN(0x10376, 0), RUN(0x1037b, 1),
+  RUN(0x10a01, 0), RUN(0x10a04, 1), RUN(0x10a05, 0), RUN(0x10a07, 1),
+  RUN(0x10a0c, 0), RUN(0x10a10, 1), RUN(0x10a38, 0), RUN(0x10a3b, 1),
+  RUN(0x10a3f, 0), RUN(0x10a40, 1), RUN(0x10ae5, 0), RUN(0x10ae7, 1),
+  RUN(0x10d24, 0), RUN(0x10d28, 1), RUN(0x10eab, 0), RUN(0x10ead, 1),
+  RUN(0x10f46, 0), RUN(0x10f51, 1), RUN(0x10f82, 0), RUN(0x10f86, 1),
+  RUN(0x11001, 0), RUN(0x11002, 1), RUN(0x11038, 0), RUN(0x11047, 1),
+  RUN(0x11070, 0), RUN(0x11071, 1), RUN(0x11073, 0), RUN(0x11075, 1),
+  RUN(0x1107f, 0), RUN(0x11082, 1), RUN(0x110b3, 0), RUN(0x110b7, 1),
+  RUN(0x110b9, 0), RUN(0x110bb, 1), RUN(0x110c2, 0), RUN(0x110c3, 1),
+  RUN(0x11100, 0), RUN(0x11103, 1), RUN(0x11127, 0), RUN(0x1112c, 1),
+  RUN(0x1112d, 0), RUN(0x11135, 1), RUN(0x11173, 0), RUN(0x11174, 1),
+  RUN(0x11180, 0), RUN(0x11182, 1), RUN(0x111b6, 0), RUN(0x111bf, 1),
+  RUN(0x111c9, 0), RUN(0x111cd, 1), RUN(0x111cf, 0), RUN(0x111d0, 1),
+  RUN(0x1122f, 0), RUN(0x11232, 1), RUN(0x11234, 0), RUN(0x11235, 1),
+  RUN(0x11236, 0), RUN(0x11238, 1), RUN(0x1123e, 0), RUN(0x1123f, 1),
+  RUN(0x112df, 0), RUN(0x112e0, 1), RUN(0x112e3, 0), RUN(0x112eb, 1),
+  RUN(0x11300, 0), RUN(0x11302, 1), RUN(0x1133b, 0), RUN(0x1133d, 1),
+  RUN(0x11340, 0), RUN(0x11341, 1), RUN(0x11366, 0), RUN(0x1136d, 1),
+  RUN(0x11370, 0), RUN(0x11375, 1), RUN(0x11438, 0), RUN(0x11440, 1),
+  RUN(0x11442, 0), RUN(0x11445, 1), RUN(0x11446, 0), RUN(0x11447, 1),
+  RUN(0x1145e, 0), RUN(0x1145f, 1), RUN(0x114b3, 0), RUN(0x114b9, 1),
+  RUN(0x114ba, 0), RUN(0x114bb, 1), RUN(0x114bf, 0), RUN(0x114c1, 1),
+  RUN(0x114c2, 0), RUN(0x114c4, 1), RUN(0x115b2, 0), RUN(0x115b6, 1),
+  RUN(0x115bc, 0), RUN(0x115be, 1), RUN(0x115bf, 0), RUN(0x115c1, 1),
+  RUN(0x115dc, 0), RUN(0x115de, 1), RUN(0x11633, 0), RUN(0x1163b, 1),
+  RUN(0x1163d, 0), RUN(0x1163e, 1), RUN(0x1163f, 0), RUN(0x11641, 1),
+  RUN(0x116ab, 0), RUN(0x116ac, 1), RUN(0x116ad, 0), RUN(0x116ae, 1),
+  RUN(0x116b0, 0), RUN(0x116b6, 1), RUN(0x116b7, 0), RUN(0x116b8, 1),
+  RUN(0x1171d, 0), RUN(0x11720, 1), RUN(0x11722, 0), RUN(0x11726, 1),
+  RUN(0x11727, 0), RUN(0x1172c, 1), RUN(0x1182f, 0), RUN(0x11838, 1),
+  RUN(0x11839, 0), RUN(0x1183b, 1), RUN(0x1193b, 0), RUN(0x1193d, 1),
+  RUN(0x1193e, 0), RUN(0x1193f, 1), RUN(0x11943, 0), RUN(0x11944, 1),
+  RUN(0x119d4, 0), RUN(0x119d8, 1), RUN(0x119da, 0), RUN(0x119dc, 1),
+  RUN(0x119e0, 0), RUN(0x119e1, 1), RUN(0x11a01, 0), RUN(0x11a0b, 1),
+  RUN(0x11a33, 0), RUN(0x11a39, 1), RUN(0x11a3b, 0), RUN(0x11a3f, 1),
+  RUN(0x11a47, 0), RUN(0x11a48, 1), RUN(0x11a51, 0), RUN(0x11a57, 1),
+  RUN(0x11a59, 0), RUN(0x11a5c, 1), RUN(0x11a8a, 0), RUN(0x11a97, 1),
+  RUN(0x11a98, 0), RUN(0x11a9a, 1), RUN(0x11c30, 0), RUN(0x11c37, 1),
+  RUN(0x11c38, 0), RUN(0x11c3e, 1), RUN(0x11c3f, 0), RUN(0x11c40, 1),
+  RUN(0x11c92, 0), RUN(0x11ca8, 1), RUN(0x11caa, 0), RUN(0x11cb1, 1),
+  RUN(0x11cb2, 0), RUN(0x11cb4, 1), RUN(0x11cb5, 0), RUN(0x11cb7, 1),
+  RUN(0x11d31, 0), RUN(0x11d37, 1), RUN(0x11d3a, 0), RUN(0x11d3b, 1),
+  RUN(0x11d3c, 0), RUN(0x11d3e, 1), RUN(0x11d3f, 0), RUN(0x11d46, 1),
+  RUN(0x11d47, 0), RUN(0x11d48, 1), RUN(0x11d90, 0), RUN(0x11d92, 1),
+  RUN(0x11d95, 0), RUN(0x11d96, 1), RUN(0x11d97, 0), RUN(0x11d98, 1),
+  RUN(0x11ef3, 0), RUN(0x11ef5, 1), RUN(0x13430, 0), RUN(0x13439, 1),
+  RUN(0x16af0, 0), RUN(0x16af5, 1), RUN(0x16b30, 0), RUN(0x16b37, 1),
+  RUN(0x16f4f, 0), RUN(0x16f50, 1), RUN(0x16f8f, 0), RUN(0x16f93, 1),
+  RUN(0x16fe0, 2), RUN(0x16fe4, 0), RUN(0x16fe5, 1), RUN(0x16ff0, 2),
+  RUN(0x16ff2, 1), RUN(0x17000, 2), RUN(0x187f8, 1), RUN(0x18800, 2),
+  RUN(0x18cd6, 1), RUN(0x18d00, 2), RUN(0x18d09, 1), RUN(0x1aff0, 2),
+  RUN(0x1aff4, 1), RUN(0x1aff5, 2), RUN(0x1affc, 1), RUN(0x1affd, 2),
+  RUN(0x1afff, 1), RUN(0x1b000, 2), RUN(0x1b123, 1), RUN(0x1b150, 2),
+  RUN(0x1b153, 1), RUN(0x1b164, 2), RUN(0x1b168, 1), RUN(0x1b170, 2),
+  RUN(0x1b2fc, 1), RUN(0x1bc9d, 0), RUN(0x1bc9f, 1), RUN(0x1bca0, 0),
+  RUN(0x1bca4, 1), RUN(0x1cf00, 0), RUN(0x1cf2e, 1), RUN(0x1cf30, 0),
+  RUN(0x1cf47, 1), RUN(0x1d167, 0), RUN(0x1d16a, 1), RUN(0x1d173, 0),
+  RUN(0x1d183, 1), RUN(0x1d185, 0), RUN(0x1d18c, 1), RUN(0x1d1aa, 0),
+  RUN(0x1d1ae, 1), RUN(0x1d242, 0), RUN(0x1d245, 1), RUN(0x1da00, 0),
+  RUN(0x1da37, 1), RUN(0x1da3b, 0), RUN(0x1da6d, 1), RUN(0x1da75, 0),
+  RUN(0x1da76, 1), RUN(0x1da84, 0), RUN(0x1da85, 1), RUN(0x1da9b, 0),
+  RUN(0x1daa0, 1), RUN(0x1daa1, 0), RUN(0x1dab0, 1), RUN(0x1e000, 0),
+  RUN(0x1e007, 1), RUN(0x1e008, 0), RUN(0x1e019, 1), RUN(0x1e01b, 0),
+  RUN(0x1e022, 1), RUN(0x1e023, 0), RUN(0x1e025, 1), RUN(0x1e026, 0),
+  RUN(0x1e02b, 1), RUN(0x1e130, 0), RUN(0x1e137, 1), RUN(0x1e2ae, 0),
+  RUN(0x1e2af, 1), RUN(0x1e2ec, 0), RUN(0x1e2f0, 1), RUN(0x1e8d0, 0),
+  RUN(0x1e8d7, 1), RUN(0x1e944, 0), RUN(0x1e94b, 1), RUN(0x1f004, 2),
+  RUN(0x1f005, 1), RUN(0x1f0cf, 2), RUN(0x1f0d0, 1), RUN(0x1f18e, 2),
+  RUN(0x1f18f, 1), RUN(0x1f191, 2), RUN(0x1f19b, 1), RUN(0x1f200, 2),
+  RUN(0x1f203, 1), RUN(0x1f210, 2), RUN(0x1f23c, 1), RUN(0x1f240, 2),
+  RUN(0x1f249, 1), RUN(0x1f250, 2), RUN(0x1f252, 1), RUN(0x1f260, 2),
+  RUN(0x1f266, 1), RUN(0x1f300, 2), RUN(0x1f321, 1), RUN(0x1f32d, 2),
+  RUN(0x1f336, 1), RUN(0x1f337, 2), RUN(0x1f37d, 1), RUN(0x1f37e, 2),
+  RUN(0x1f394, 1), RUN(0x1f3a0, 2), RUN(0x1f3cb, 1), RUN(0x1f3cf, 2),
+  RUN(0x1f3d4, 1), RUN(0x1f3e0, 2), RUN(0x1f3f1, 1), RUN(0x1f3f4, 2),
+  RUN(0x1f3f5, 1), RUN(0x1f3f8, 2), RUN(0x1f43f, 1), RUN(0x1f440, 2),
+  RUN(0x1f441, 1), RUN(0x1f442, 2), RUN(0x1f4fd, 1), RUN(0x1f4ff, 2),
+  RUN(0x1f53e, 1), RUN(0x1f54b, 2), RUN(0x1f54f, 1), RUN(0x1f550, 2),
+  RUN(0x1f568, 1), RUN(0x1f57a, 2), RUN(0x1f57b, 1), RUN(0x1f595, 2),
+  RUN(0x1f597, 1), RUN(0x1f5a4, 2), RUN(0x1f5a5, 1), RUN(0x1f5fb, 2),
+  RUN(0x1f650, 1), RUN(0x1f680, 2), RUN(0x1f6c6, 1), RUN(0x1f6cc, 2),
+  RUN(0x1f6cd, 1), RUN(0x1f6d0, 2), RUN(0x1f6d3, 1), RUN(0x1f6d5, 2),
+  RUN(0x1f6d8, 1), RUN(0x1f6dd, 2), RUN(0x1f6e0, 1), RUN(0x1f6eb, 2),
+  RUN(0x1f6ed, 1), RUN(0x1f6f4, 2), RUN(0x1f6fd, 1), RUN(0x1f7e0, 2),
+  RUN(0x1f7ec, 1), RUN(0x1f7f0, 2), RUN(0x1f7f1, 1), RUN(0x1f90c, 2),
+  RUN(0x1f93b, 1), RUN(0x1f93c, 2), RUN(0x1f946, 1), RUN(0x1f947, 2),
+  RUN(0x1fa00, 1), RUN(0x1fa70, 2), RUN(0x1fa75, 1), RUN(0x1fa78, 2),
+  RUN(0x1fa7d, 1), RUN(0x1fa80, 2), RUN(0x1fa87, 1), RUN(0x1fa90, 2),
+  RUN(0x1faad, 1), RUN(0x1fab0, 2), RUN(0x1fabb, 1), RUN(0x1fac0, 2),
+  RUN(0x1fac6, 1), RUN(0x1fad0, 2), RUN(0x1fada, 1), RUN(0x1fae0, 2),
+  RUN(0x1fae8, 1), RUN(0x1faf0, 2), RUN(0x1faf7, 1), RUN(0x20000, 2),
+  RUN(0x2a6e0, 1), RUN(0x2a700, 2), RUN(0x2b739, 1), RUN(0x2b740, 2),
+  RUN(0x2b81e, 1), RUN(0x2b820, 2), RUN(0x2cea2, 1), RUN(0x2ceb0, 2),
+  RUN(0x2ebe1, 1), RUN(0x2f800, 2), RUN(0x2fa1e, 1), RUN(0x30000, 2),
+  RUN(0x3134b, 1), RUN(0xe0001, 0), RUN(0xe0002, 1), RUN(0xe0020, 0),
+  RUN(0xe0080, 1), RUN(0xe0100, 0), RUN(0xe01f0, 1),
+};
+
+/* Bytes of the character at s, of the n there, and its code point in *cp,
+ * or -1 if they aren't a printable one, then it's taken as one byte. */
+int utf8Char(const char* s, int n, int* cp) {
+  const unsigned char* p = (const unsigned char*)s;
+  int len, v, min;
+  if (p[0] < 0x80) {
+    *cp = p[0];
+    return 1;
+  } else if (p[0] >= 0xc2 && p[0] <= 0xdf) {
+    len = 2;
+    v = p[0] & 0x1f;
+    min = 0xa0; /* below are the C1 controls */
+  } else if ((p[0] & 0xf0) == 0xe0) {
+    len = 3;
+    v = p[0] & 0x0f;
+    min = 0x800;
+  } else if (p[0] >= 0xf0 && p[0] <= 0xf4) {
+    len = 4;
+    v = p[0] & 0x07;
+    min = 0x10000;
+  } else {
+    *cp = -1;
+    return 1;
+  }
+  if (len > n) {
+    *cp = -1;
+    return 1;
+  }
+  for (int k = 1; k < len; k++) {
+    if ((p[k] & 0xc0) != 0x80) {
+      *cp = -1;
+      return 1;
+    }
+    v = v << 6 | (p[k] & 0x3f);
+  }
+  /* overlong, surrogate or past the last code point */
+  if (v < min || (v >= 0xd800 && v <= 0xdfff) || v > 0x10ffff) {
+    *cp = -1;
+    return 1;
+  }
+  *cp = v;
+  return len;
+}
+
+/* Columns taken by code point cp, 1 for -1. */
+int utf8Width(int cp) {
+  if (cp < 0x300)
+    return 1;
+  /* the last run starting at or before cp */
+  int lo = 0;
+  int hi = sizeof(widthRuns) / sizeof(widthRuns[0]);
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (widthRuns[mid] >> 2 <= (unsigned int)cp)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo == 0 ? 1 : widthRuns[lo - 1] & 3;
+}
+
+/* Span kernels: the bytes of s[0, n) before the first that isn't ASCII or
+ * is a tab, copied to out on the way unless it's NULL. They may copy more
+ * of s than that, up to n bytes. */
+static int spanScalar(char* out, const char* s, int n) {
+  const uint64_t ones = 0x0101010101010101ULL;
+  const uint64_t high = 0x8080808080808080ULL;
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t w;
+    memcpy(&w, &s[i], 8);
+    uint64_t t = w ^ (ones * '\t');
+    /* a zero byte in t is a tab */
+    if ((w & high) || ((t - ones) & ~t & high))
+      break;
+  }
+  while (i < n && (unsigned char)s[i] < 0x80 && s[i] != '\t')
+    i++;
+  if (out)
+    memcpy(out, s, i);
+  return i;
+}
+
+#ifdef HAVE_X86_SIMD
+/* The top bit of a byte of v that's non-ASCII or, once compared, a tab. */
+static unsigned stopMask16(__m128i v) {
+  __m128i tab = _mm_set1_epi8('\t');
+  return _mm_movemask_epi8(_mm_or_si128(v, _mm_cmpeq_epi8(v, tab)));
+}
+
+static int spanSSE2(char* out, const char* s, int n) {
+  if (n < 16)
+    return spanScalar(out, s, n);
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)&s[i]);
+    if (out)
+      _mm_storeu_si128((__m128i*)&out[i], v);
+    unsigned mask = stopMask16(v);
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  if (i == n)
+    return n;
+  /* the last 16 bytes, less the ones already checked */
+  int last = n - 16;
+  __m128i v = _mm_loadu_si128((const __m128i*)&s[last]);
+  if (out)
+    _mm_storeu_si128((__m128i*)&out[last], v);
+  unsigned mask = stopMask16(v) >> (i - last);
+  return mask ? i + __builtin_ctz(mask) : n;
+}
+
+__attribute__((target("avx2"))) static int spanAVX2(char* out,
+                                                    const char* s,
+                                                    int n) {
+  const __m256i tab = _mm256_set1_epi8('\t');
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)&s[i]);
+    if (out)
+      _mm256_storeu_si256((__m256i*)&out[i], v);
+    unsigned mask =
+        _mm256_movemask_epi8(_mm256_or_si256(v, _mm256_cmpeq_epi8(v, tab)));
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  if (i == 0)
+    return spanSSE2(out, s, n);
+  if (i == n)
+    return n;
+  int last = n - 32;
+  __m256i v = _mm256_loadu_si256((const __m256i*)&s[last]);
+  if (out)
+    _mm256_storeu_si256((__m256i*)&out[last], v);
+  unsigned mask =
+      _mm256_movemask_epi8(_mm256_or_si256(v, _mm256_cmpeq_epi8(v, tab))) >>
+      (i - last);
+  return mask ? i + __builtin_ctz(mask) : n;
+}
+#endif
+
+static int (*spanKernel)(char*, const char*, int) = NULL;
+
+static void pickKernels() {
+  if (spanKernel)
+    return;
+  spanKernel = spanScalar;
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    spanKernel = spanAVX2;
+  else if (__builtin_cpu_supports("sse2"))
+    spanKernel = spanSSE2;
+#endif
+}
+
+/* Bytes at s before the first that isn't ASCII or is a tab, n if there is
+ * none: a run that takes a byte and a column per character, which is most
+ * text. */
+int utf8Span(const char* s, int n) {
+  pickKernels();
+  return spanKernel(NULL, s, n);
+}
+
+/* utf8Span, copying the run to out as it's found. Bytes of out past the
+ * run may be written too, up to n. */
+int utf8Copy(char* out, const char* s, int n) {
+  pickKernels();
+  return spanKernel(out, s, n);
+}
@@ -0,0 +1,18 @@
+#ifndef __utf8_h__
+#define __utf8_h__
+
+/* most bytes of one UTF-8 character */
+#define UTF8_MAX 4
+
+/* UTF-8 text as it's displayed. A character takes 0 columns (combining
+ * marks and other format characters, drawn on the one before), 1 or 2
+ * (East Asian wide and fullwidth ones), see utf8Width. Bytes that don't
+ * decode to a printable character, e.g. a sequence cut short, are taken one
+ * at a time as a column each and shown as '?'. */
+int utf8Char(const char*, int, int*);
+int utf8Width(int);
+/* plain ASCII scanning kernels, picked at runtime by CPU features */
+int utf8Span(const char*, int);
+int utf8Copy(char*, const char*, int);
+
+#endif